@@ -3,8 +3,8 @@
 
 #include "kgd/genotype/selfawaregenome.hpp"
 
-#include "../misc/fixed_size_string.hpp"
 #include "../misc/gvc_wrapper.h"
+#include "functions.h"
 
 // =============================================================================
 // == Define CPPN I/O based on cmake-provided flags
@@ -77,7 +77,7 @@ public:
 
     struct Node {
       HAS_GENOME_ID(Node)
-      using FuncID = utils::fixed_string<4>;
+      using FuncID = cppn::FuncID;
       FuncID func;
 
       Node (ID id, FuncID f) : id(id), func(f) {}
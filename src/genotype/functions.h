@@ -0,0 +1,102 @@
+#ifndef KGD_CPPN_FUNCTIONS_H
+#define KGD_CPPN_FUNCTIONS_H
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <initializer_list>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <utility>
+
+// utils::Thrower, utils::assertEqual and nlohmann::json
+#include "kgd/genotype/selfawaregenome.hpp"
+
+namespace genotype::cppn {
+
+/// Identifier of a CPPN activation function
+/// Values are dense (usable as array indices or switch cases) and ordered as
+/// the names (e.g. "gaus"), which are only used for I/O (json, dot, config
+/// files): ordered containers thus iterate in the same order as with names.
+/// Default-constructed identifiers are empty (e.g. for unset dot attributes)
+class FuncID {
+public:
+  enum Value : uint8_t { ABS, BSGM, GAUS, ID, SIN, SSGM, SSGN, STEP };
+  static constexpr uint SIZE = STEP+1;
+
+  static constexpr std::array<const char*, SIZE> names {{
+    "abs", "bsgm", "gaus", "id", "sin", "ssgm", "ssgn", "step"
+  }};
+
+  constexpr FuncID (void) : _value(SIZE) {}
+  constexpr FuncID (Value v) : _value(v) {}
+
+  FuncID (const char *name) : FuncID(std::string(name)) {}
+
+  explicit FuncID (const std::string &name) : FuncID() {
+    if (name.empty()) return;
+    for (uint i=0; i<SIZE; i++)
+      if (name == names[i]) _value = i;
+    if (empty())  utils::Thrower("Unknown CPPN function '", name, "'");
+  }
+
+  constexpr operator Value (void) const { return Value(_value); }
+
+  constexpr bool empty (void) const {
+    return _value == SIZE;
+  }
+
+  const char* name (void) const {
+    return empty() ? "" : names[_value];
+  }
+
+  explicit operator std::string (void) const {
+    return name();
+  }
+
+  friend void to_json(nlohmann::json &j, const FuncID &f) {
+    j = f.name();
+  }
+
+  friend void from_json(const nlohmann::json &j, FuncID &f) {
+    f = FuncID(j.get<std::string>());
+  }
+
+  friend std::ostream& operator<< (std::ostream &os, const FuncID &f) {
+    return os << f.name();
+  }
+
+  friend std::istream& operator>> (std::istream &is, FuncID &f) {
+    std::string s;
+    is >> s;
+    f = FuncID(s);
+    return is;
+  }
+
+  friend void assertEqual (const FuncID &lhs, const FuncID &rhs, bool &ok) {
+    using utils::assertEqual;
+    assertEqual(std::string(lhs), std::string(rhs), ok);
+  }
+
+private:
+  uint8_t _value;
+};
+
+/// Per-function data, indexed by FuncID
+template <typename T>
+using FunctionArray = std::array<T, FuncID::SIZE>;
+
+/// Builds a FunctionArray from (function, value) pairs, in any order
+template <typename T>
+FunctionArray<T> functionArray (
+    std::initializer_list<std::pair<FuncID, T>> values) {
+  FunctionArray<T> a {};
+  for (const auto &p: values) a[p.first] = p.second;
+  assert(values.size() == FuncID::SIZE);
+  return a;
+}
+
+} // end of namespace genotype::cppn
+
+#endif // KGD_CPPN_FUNCTIONS_H
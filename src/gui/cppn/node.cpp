@@ -52,9 +52,9 @@ const auto autoplotter = [] (phenotype::CPPN::Function f) {
 };
 
 const auto mapBuilder = [] {
-  std::map<NodeFunc, QPainterPath> m;
-  for (const auto &p: phenotype::CPPN::functions)
-    m[p.first] = autoplotter(p.second);
+  genotype::cppn::FunctionArray<QPainterPath> m;
+  for (uint i=0; i<m.size(); i++)
+    m[i] = autoplotter(phenotype::CPPN::functions[i]);
   return m;
 };
 
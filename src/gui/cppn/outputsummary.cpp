@@ -113,11 +113,11 @@ void OutputSummary::phenotypes (const phenotype::CPPN &cppn, const QPointF &p,
 
   noPhenotypes(flag);
 
-  std::array<CPPN::Outputs, 2> outputs;
+  std::array<CPPN::BatchOutputs, 2> outputs;
 
   std::vector<phenotype::CPPN::Range> ranges;
-  ranges.resize(outputs.size());
-  for (uint i=0; i<outputs.size(); i++)
+  ranges.resize(CPPN::OUTPUTS);
+  for (uint i=0; i<ranges.size(); i++)
     ranges[i] = functionRanges.at(cppnOutputFuncs[i]);
 
   static const auto rw_color = [] (float v) {
@@ -126,37 +126,40 @@ void OutputSummary::phenotypes (const phenotype::CPPN &cppn, const QPointF &p,
                    : QColor::fromHsv(0, 0, v*255).rgb();
   };
 
-  const auto w_color = [&outputs, &ranges] (uint i, uint j) {
-    return rw_color(outputs[i][j]);
+  const auto w_color = [&outputs] (uint i, uint j, uint k) {
+    return rw_color(outputs[i][j][k]);
   };
 
-  const auto l_color = [&outputs, &ranges] (uint i, uint j) {
-    return QColor::fromHsv(0, 0, scale(ranges[j], qImageRange, outputs[i][j]))
-        .rgb();
+  const auto l_color = [&outputs, &ranges] (uint i, uint j, uint k) {
+    return QColor::fromHsv(0, 0, scale(ranges[j], qImageRange,
+                                       outputs[i][j][k])).rgb();
   };
 
+  // All pixel coordinates, row by row
+  // Invert y to account for downward y axis windows
+  CPPN::Grid grid;
+  grid.rows.resize(S);
+  grid.columns.resize(S);
+  for (int r=0; r<S; r++)  grid.rows[r].set(1, -2.*r/(S-1) + 1);
+  for (int c=0; c<S; c++)  grid.columns[c] = 2.*c/(S-1) - 1;
+
   // Generate output for neural parameter /// TODO Only one for now
   if (flag & NEURAL) {
-    phenotype::Point p1 {0,0};
+    std::vector<float> biases;
+    cppn(grid, phenotype::Point{0,0}, biases, genotype::cppn::Output::BIAS);
     for (int r=0; r<S; r++) {
       QRgb *bytes = (QRgb*)_nviewers[0]->image.scanLine(r);
-      phenotype::Point p0;
-      p0.set(1, -2.*r/(S-1) + 1);
-
-      for (int c=0; c<S; c++) {
-        p0.set(0, 2.*c/(S-1) - 1);
-        bytes[c] = rw_color(
-          utils::clip(-1.f,
-                      cppn(p0, p1, genotype::cppn::Output::BIAS),
-                      1.f));
-      }
+      for (int c=0; c<S; c++)
+        bytes[c] = rw_color(utils::clip(-1.f, biases[r*S+c], 1.f));
     }
     _nviewers[0]->enabled = true;
     _nviewers[0]->update();
   }
 
   /// TODO Check that I did not break everything
-  phenotype::Point p0 {float(p.x()), float(p.y())};
+  const phenotype::Point p0 {float(p.x()), float(p.y())};
+  cppn(p0, grid, outputs[0]);
+  cppn(grid, p0, outputs[1]);
   for (int r=0; r<S; r++) {
     std::array<QRgb*, 4> bytes;
     for (uint i=0; i<_cviewers.size(); i++)
@@ -164,23 +167,16 @@ void OutputSummary::phenotypes (const phenotype::CPPN &cppn, const QPointF &p,
        || (i >= 2 && (flag & INCOMING)))
         bytes[i] = (QRgb*) _cviewers[i]->image.scanLine(r);
 
-    phenotype::Point p1;
-    // Invert y to account for downward y axis windows
-    p1.set(1, -2.*r/(S-1) + 1);
-
     for (int c=0; c<S; c++) {
-      p1.set(0, 2.*c/(S-1) - 1);
-      cppn(p0, p1, outputs[0]);
-      cppn(p1, p0, outputs[1]);
-
+      uint k = r*S+c;
       if (flag & OUTGOING) {
-        bytes[0][c] = w_color(0, 0);
-        bytes[1][c] = l_color(0, 1);
+        bytes[0][c] = w_color(0, 0, k);
+        bytes[1][c] = l_color(0, 1, k);
       }
 
       if (flag & INCOMING) {
-        bytes[2][c] = w_color(1, 0);
-        bytes[3][c] = l_color(1, 1);
+        bytes[2][c] = w_color(1, 0, k);
+        bytes[3][c] = l_color(1, 1, k);
       }
     }
   }
@@ -0,0 +1,365 @@
+#include <cstring>
+
+#include "activations.h"
+#include "cppn.h"
+#include "fmath.h"
+
+namespace phenotype::activations {
+
+#if defined(__x86_64__)
+#define KGD_X86_KERNELS
+#endif
+
+namespace {
+
+#include "kernels.inc"
+
+#ifdef KGD_X86_KERNELS
+/// Same formulas compiled for AVX2, as are the kernels using them: vectors
+/// of 8 floats are thus never passed to functions lacking the instruction set
+/// (which gcc would warn about through -Wpsabi)
+namespace avx {
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include "kernels.inc"
+#pragma GCC pop_options
+} // end of namespace avx
+#endif
+
+// =============================================================================
+// -- Batch drivers
+
+template <typename K>
+void scalar (const float *in, float *out, uint n) {
+  for (uint i=0; i<n; i++)  out[i] = K::scalar(in[i]);
+}
+
+// Vector types cannot depend on a template parameter
+using F4 = float __attribute__((vector_size(4*sizeof(float))));
+using F8 = float __attribute__((vector_size(8*sizeof(float))));
+
+template <typename K>
+void reduced (const float *in, float *out, uint n) {
+  reduced<F4, K>(in, out, n);
+}
+
+#ifdef KGD_X86_KERNELS
+template <typename K>
+void sse2 (const float *in, float *out, uint n) {
+  batch<F4, K>(in, out, n);
+}
+
+/// K is the avx:: copy of the formulas
+template <typename K>
+__attribute__((target("avx2")))
+void avx2 (const float *in, float *out, uint n) {
+  avx::batch<F8, K>(in, out, n);
+}
+
+template <typename K>
+__attribute__((target("avx2")))
+void reducedAVX2 (const float *in, float *out, uint n) {
+  avx::reduced<F8, K>(in, out, n);
+}
+#endif
+
+using Kernels = std::array<Kernel, 3>;
+
+/// K and its AVX2-compiled copy KA
+template <typename K, typename KA>
+Kernels kernels (void) {
+#ifdef KGD_X86_KERNELS
+  return { &scalar<K>, &sse2<K>, &avx2<KA> };
+#else
+  return { &scalar<K>, &scalar<K>, &scalar<K> };
+#endif
+}
+
+/// Generic vectors (i.e. sse2 on x86-64) otherwise
+template <typename K, typename KA>
+Kernels reducedKernels (void) {
+#ifdef KGD_X86_KERNELS
+  return { &reduced<K>, &reduced<K>, &reducedAVX2<KA> };
+#else
+  return { &reduced<K>, &reduced<K>, &reduced<K> };
+#endif
+}
+
+#ifdef KGD_X86_KERNELS
+#define KERNELS(K) activations::kernels<K, avx::K>()
+#define REDUCED_KERNELS(K) activations::reducedKernels<K, avx::K>()
+#else
+#define KERNELS(K) activations::kernels<K, K>()
+#define REDUCED_KERNELS(K) activations::reducedKernels<K, K>()
+#endif
+
+// =============================================================================
+// -- Tabulated approximations
+
+using Config = config::Activations;
+
+struct Table {
+  float lo, hi;   ///< Domain
+  float period;   ///< Inputs are wrapped (if non-zero) or clamped to the domain
+  float scale;    ///< Samples per unit
+  float nan;      ///< Exact value for NaNs (and, if periodic, infinities)
+  std::vector<float> values;
+
+  float operator() (float x) const {
+    if (std::isnan(x))  return nan;
+    if (period > 0) {
+      float t = x / period + .5f;
+      if (std::fabs(t) < (1 << 23)) { // Truncation-based floor (std::floor is
+        int k = t;                    //  a call on x86-64), in the int range
+        if (t < k)  k--;
+        x -= period * k;
+      } else {                        // Exact reduction, NaN for infinities
+        x = std::remainder(x, period);
+        if (std::isnan(x))  return nan;
+      }
+    }
+    x = std::min(std::max(x, lo), hi);
+
+    float u = (x - lo) * scale;
+    uint i = std::min(uint(u), uint(values.size()-2));
+    float f = u - i;
+    return values[i] + f * (values[i+1] - values[i]);
+  }
+};
+
+template <typename K>
+const Table& table (void) {
+  static const Table t = [] {
+    static const auto &resolution = Config::tableResolution();
+    static const auto &domain = Config::tableDomain();
+    Table t;
+    if (std::is_same_v<K, Sin>) { // sin(2x) has period pi
+      t.period = M_PI;
+      t.hi = .5 * t.period;
+    } else {
+      t.period = 0;
+      t.hi = domain;
+    }
+    t.lo = -t.hi;
+    t.nan = K::scalar(NAN);
+
+    uint n = std::max(1u, uint(std::ceil((t.hi - t.lo) * resolution)));
+    t.scale = n / (t.hi - t.lo);
+    t.values.resize(n+1);
+    for (uint i=0; i<=n; i++) {
+      float v = K::scalar(t.lo + (t.hi - t.lo) * i / n);
+      // Subnormal values (e.g. gaussian tails) would slow down interpolation
+      if (std::fabs(v) < std::numeric_limits<float>::min())  v = 0;
+      t.values[i] = v;
+    }
+    return t;
+  }();
+  return t;
+}
+
+template <typename K>
+float tabulated (float x) {
+  return table<K>()(x);
+}
+
+template <typename K>
+void tabulatedBatch (const float *in, float *out, uint n) {
+  const Table &t = table<K>();
+  for (uint i=0; i<n; i++)  out[i] = t(in[i]);
+}
+
+struct Tabulated {
+  Function exact, approximation;
+  Kernel kernel;
+};
+
+template <typename K>
+Tabulated tabulated (void) {
+  return { &K::scalar, &tabulated<K>, &tabulatedBatch<K> };
+}
+
+const std::map<FuncID, Tabulated>& tables (void) {
+  static const std::map<FuncID, Tabulated> tables {
+    { FuncID::GAUS, tabulated<Gaus>() },
+    { FuncID::SSGM, tabulated<Ssgm>() },
+    { FuncID::BSGM, tabulated<Bsgm>() },
+    {  FuncID::SIN, tabulated<Sin>()  },
+    { FuncID::SSGN, tabulated<Ssgn>() },
+  };
+  return tables;
+}
+
+/// Tabulated version of f, if any, in the current mode
+const Tabulated* tabulation (const FuncID &f) {
+  if (!Config::tabulated()) return nullptr;
+  switch (f) {
+  case FuncID::GAUS: case FuncID::SSGM: case FuncID::BSGM:
+  case FuncID::SIN: case FuncID::SSGN:
+    return &tables().at(f);
+  default:
+    return nullptr;
+  }
+}
+
+// =============================================================================
+// -- Interval extensions
+
+template <typename K>
+Range interval (Range r) {
+  if (std::isnan(r.min) || std::isnan(r.max))  return { NAN, NAN };
+  if constexpr (std::is_same_v<K, Sin>) {
+    // Periodic tables wrap inputs with an error growing with |x|: the sampled
+    // errors only hold within the sampled range (see tabulationErrors)
+    if (Config::tabulated()) {
+      const float limit = 2 * std::max(Config::tableDomain(), float(M_PI));
+      if (r.min < -limit || limit < r.max)  return K::RANGE;
+    }
+  }
+  Range b = K::bounds(r);
+  if constexpr (K::SMOOTH) {
+    // A few ulps of the intermediate values (all within [-2, 2])
+    float pad = 1e-6;
+    if (Config::tabulated()) {  // Interpolation errors (sampled)
+      static const float error = [] {
+        for (const auto &p: tables())
+          if (p.second.exact == &K::scalar)
+            return tabulationErrors().at(p.first).absolute;
+        return 0.f;
+      }();
+      pad += 2 * error;
+    }
+    b.min = std::max(K::RANGE.min, b.min - pad);
+    b.max = std::min(K::RANGE.max, b.max + pad);
+  }
+  return b;
+}
+
+} // end of anonymous namespace
+
+InstructionSet bestInstructionSet (void) {
+  static const InstructionSet best = [] {
+#ifdef KGD_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return InstructionSet::AVX2;
+    return InstructionSet::SSE2;
+#else
+    return InstructionSet::SCALAR;
+#endif
+  }();
+  return best;
+}
+
+bool supported (InstructionSet is) {
+  return uint(is) <= uint(bestInstructionSet());
+}
+
+std::ostream& operator<< (std::ostream &os, InstructionSet is) {
+  static const std::array<const char*, 3> names {{ "scalar", "sse2", "avx2" }};
+  return os << names[uint(is)];
+}
+
+Kernel kernel (const FuncID &f, InstructionSet is) {
+  using genotype::cppn::functionArray;
+  static const auto kernels = functionArray<Kernels>({
+    {  FuncID::ABS, KERNELS(Abs)  },
+    { FuncID::GAUS, KERNELS(Gaus) },
+    {   FuncID::ID, KERNELS(Id)   },
+    { FuncID::SSGM, KERNELS(Ssgm) },
+    { FuncID::BSGM, KERNELS(Bsgm) },
+    {  FuncID::SIN, KERNELS(Sin)  },
+    { FuncID::STEP, KERNELS(Step) },
+    { FuncID::SSGN, KERNELS(Ssgn) },
+  });
+  assert(supported(is));
+  if (auto t = tabulation(f))  return t->kernel;
+  return kernels.at(f)[uint(is)];
+}
+
+Kernel reducedKernel (const FuncID &f, InstructionSet is) {
+  using genotype::cppn::functionArray;
+  static const auto kernels = functionArray<Kernels>({
+    {  FuncID::ABS, REDUCED_KERNELS(Abs)  },
+    { FuncID::GAUS, REDUCED_KERNELS(Gaus) },
+    {   FuncID::ID, REDUCED_KERNELS(Id)   },
+    { FuncID::SSGM, REDUCED_KERNELS(Ssgm) },
+    { FuncID::BSGM, REDUCED_KERNELS(Bsgm) },
+    {  FuncID::SIN, REDUCED_KERNELS(Sin)  },
+    { FuncID::STEP, REDUCED_KERNELS(Step) },
+    { FuncID::SSGN, REDUCED_KERNELS(Ssgn) },
+  });
+  assert(supported(is));
+  return kernels.at(f)[uint(is)];
+}
+
+#undef KERNELS
+#undef REDUCED_KERNELS
+
+IntervalFunction bounds (const FuncID &f) {
+  using genotype::cppn::functionArray;
+  static const auto functions = functionArray<IntervalFunction>({
+    {  FuncID::ABS, interval<Abs>  },
+    { FuncID::GAUS, interval<Gaus> },
+    {   FuncID::ID, interval<Id>   },
+    { FuncID::SSGM, interval<Ssgm> },
+    { FuncID::BSGM, interval<Bsgm> },
+    {  FuncID::SIN, interval<Sin>  },
+    { FuncID::STEP, interval<Step> },
+    { FuncID::SSGN, interval<Ssgn> },
+  });
+  return functions.at(f);
+}
+
+Function function (const FuncID &f) {
+  if (auto t = tabulation(f))  return t->approximation;
+  return CPPN::functions.at(f);
+}
+
+DerivativesFunction derivatives (const FuncID &f) {
+  using genotype::cppn::functionArray;
+  static const auto functions = functionArray<DerivativesFunction>({
+    {  FuncID::ABS, Abs::derivatives  },
+    { FuncID::GAUS, Gaus::derivatives },
+    {   FuncID::ID, Id::derivatives   },
+    { FuncID::SSGM, Ssgm::derivatives },
+    { FuncID::BSGM, Bsgm::derivatives },
+    {  FuncID::SIN, Sin::derivatives  },
+    { FuncID::STEP, Step::derivatives },
+    { FuncID::SSGN, Ssgn::derivatives },
+  });
+  return functions.at(f);
+}
+
+std::map<FuncID, TabulationError> tabulationErrors (void) {
+  static const auto &domain = Config::tableDomain();
+  static const auto &resolution = Config::tableResolution();
+
+  // Sample well beyond the domain (clamping) and between table entries
+  static constexpr uint OVERSAMPLING = 16;
+  const float lo = -2 * std::max(domain, float(M_PI)), hi = -lo;
+  const uint n = (hi - lo) * resolution * OVERSAMPLING;
+
+  std::map<FuncID, TabulationError> errors;
+  for (const auto &p: tables()) {
+    const CPPN::Range &r = CPPN::functionRanges.at(p.first);
+    TabulationError e {0, 0};
+    for (uint i=0; i<=n; i++) {
+      float x = lo + (hi - lo) * i / n;
+      e.absolute = std::max(e.absolute,
+                            std::fabs(p.second.approximation(x)
+                                      - p.second.exact(x)));
+    }
+    e.relative = e.absolute / (r.max - r.min);
+    errors[p.first] = e;
+  }
+  return errors;
+}
+
+} // end of namespace phenotype::activations
+
+#define CFILE config::Activations
+
+DEFINE_PARAMETER(bool, tabulated, false)
+DEFINE_PARAMETER(uint, tableResolution, 1024)
+DEFINE_PARAMETER(float, tableDomain, 5)
+
+#undef CFILE
@@ -0,0 +1,83 @@
+#ifndef KGD_ACTIVATIONS_H
+#define KGD_ACTIVATIONS_H
+
+#include "../genotype/es-hyperneat.h"
+
+namespace phenotype::activations {
+
+using FuncID = genotype::ES_HyperNEAT::CPPN::Node::FuncID;
+
+/// Applies an activation function to n contiguous values (in may be out)
+using Kernel = void (*) (const float *in, float *out, uint n);
+
+enum class InstructionSet { SCALAR, SSE2, AVX2 };
+
+/// Most capable instruction set supported by the running CPU
+InstructionSet bestInstructionSet (void);
+
+bool supported (InstructionSet is);
+
+std::ostream& operator<< (std::ostream &os, InstructionSet is);
+
+/// Batch counterpart of function(f)
+/// Every element is bitwise identical to the scalar function, whatever the
+/// instruction set. With float-only math (ESHN_FLOAT_MATH) exponentials and
+/// sines are vectorized copies of ff_exp/ff_sin. The default double-precision
+/// versions are libm calls that cannot be reproduced and thus stay lane-wise
+Kernel kernel (const FuncID &f, InstructionSet is = bestInstructionSet());
+
+/// Cheaper approximation of kernel(f) for intermediate values (e.g. the
+/// coarse levels of the ES-HyperNEAT division) that never end up in an ANN.
+/// Exponentials and sines are fully vectorized polynomials with errors below
+/// 1e-5 (reported by tests/activations). Results are still independent from
+/// the instruction set. Ignores config::Activations::tabulated()
+Kernel reducedKernel (const FuncID &f,
+                      InstructionSet is = bestInstructionSet());
+
+using Function = float (*) (float);
+
+struct Range { float min, max; };
+using IntervalFunction = Range (*) (Range);
+
+/// Implementation of f used by CPPNs and ANNs
+/// CPPN::functions.at(f) unless config::Activations::tabulated() in which
+/// case the smooth functions (gaus, ssgm, bsgm, sin and ssgn) are linearly
+/// interpolated from precomputed tables. Inputs beyond the tables' domain are
+/// clamped (or wrapped, for the periodic sin)
+Function function (const FuncID &f);
+
+struct Derivatives { float first, second; };
+using DerivativesFunction = Derivatives (*) (float);
+
+/// First and second derivatives of CPPN::functions.at(f), for forward-mode
+/// differentiation (see CPPN::derivatives). Discontinuities (abs at 0, step)
+/// have null derivatives. Tabulated functions are differentiated as if exact
+DerivativesFunction derivatives (const FuncID &f);
+
+struct TabulationError {
+  float absolute; ///< Maximal absolute error
+  float relative; ///< Same, relative to the function's range
+};
+
+/// Interval extension of function(f): the returned range contains f(x) for
+/// every x in the input range (as computed in floating point). Returns
+/// NaN bounds for NaN inputs
+IntervalFunction bounds (const FuncID &f);
+
+/// Errors of the tabulated functions (with the current config) against the
+/// exact ones and CPPN::functionRanges
+std::map<FuncID, TabulationError> tabulationErrors (void);
+
+} // end of namespace phenotype::activations
+
+namespace config {
+
+struct CONFIG_FILE(Activations) {
+  DECLARE_PARAMETER(bool, tabulated)      // smooth functions from tables
+  DECLARE_PARAMETER(uint, tableResolution)  // samples per unit
+  DECLARE_PARAMETER(float, tableDomain)   // inputs clamped to +/- domain
+};
+
+} // end of namespace config
+
+#endif // KGD_ACTIVATIONS_H
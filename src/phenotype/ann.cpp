@@ -10,10 +10,9 @@
 #ifdef DEBUG_QUADTREE
 //#define DEBUG_QUADTREE_DIVISION
 //#define DEBUG_QUADTREE_PRUNING
-namespace phenotype::evolvable_substrate { struct QuadTreeNode; }
 namespace quadtree_debug {
-void debugGenerateImages (const phenotype::evolvable_substrate::QuadTreeNode &t,
-                          const phenotype::ANN::Point &p, bool in);
+void debugGenerateImages (const phenotype::ESBuilder::Workspace &t,
+                          const phenotype::Point &p, bool in);
 } // end of namespace quadtree_debug
 #endif
 
@@ -37,119 +36,173 @@ using Config = config::EvolvableSubstrate;
 using Coordinates = ANN::Coordinates;
 using Coordinates_s = std::set<Coordinates::value_type>;
 
-struct QOTreeNode {
-  Point center;
-  /// TODO remove
-//  static_assert(ESHN_SUBSTRATE_DIMENSION == 2, "OctoTree not implemented");
-  float radius;
-  uint level;
-  float weight;
-
-  using ptr = std::shared_ptr<QOTreeNode>;
-  std::vector<ptr> cs;
-
-  QOTreeNode (const Point &p, float r, uint l)
-    : center(p), radius(r), level(l), weight(NAN) {}
-
-#if ESHN_SUBSTRATE_DIMENSION == 2
-  QOTreeNode (float x, float y, float r, uint l)
-    : QOTreeNode({x,y}, r, l) {}
-#elif ESHN_SUBSTRATE_DIMENSION == 3
-  QOTreeNode (float x, float y, float z, float r, uint l)
-    : QOTreeNode({x,y,z}, r, l) {}
-#endif
+using Cell = ESBuilder::Cell;
+using Workspace = ESBuilder::Workspace;
 
-  float variance (void) const {
-    if (cs.empty()) return 0;
-    float mean = 0;
-    for (auto &c: cs) mean += c->weight;
-    mean /= cs.size();
-    float var = 0;
-    for (auto &c: cs) var += std::pow(c->weight - mean, 2);
-    return var / cs.size();
-  }
+/// Workers exploring a point: the quadtree is built in the workspace of the
+/// first one, the others (if any, i.e. with a pool) helping with the cells of
+/// a level and with the subtrees to prune
+struct Team {
+  QueryCache *caches;
+  Workspace *workspaces;
+  ThreadPool *pool;
 
-#if DEBUG_ES_QUADTREE
-  friend std::ostream& operator<< (std::ostream &os, const QuadTreeNode &n) {
-    utils::IndentingOStreambuf indent (os);
-    os << "QTN " << n.center << " " << n.radius << " " << n.level << " "
-              << n.weight << "\n";
-    for (const auto &c: n.cs) os << *c;
-    return os;
+  void run (uint n, const ThreadPool::Task &task) const {
+    if (pool)
+      pool->run(n, task);
+    else
+      for (uint i=0; i<n; i++)  task(i, 0);
   }
-#endif
 };
-using QOTree = QOTreeNode::ptr;
-
-template <typename... ARGS>
-QOTreeNode::ptr node (ARGS... args) {
-  return std::make_shared<QOTreeNode>(args...);
-}
 
-
-QOTree divisionAndInitialisation(const CPPN &cppn, const Point &p, bool out) {
+/// Explores the quadtree of p in breadth-first order, dividing cells until
+/// their children's weights are uniform enough, into the first workspace
+void divisionAndInitialisation(const Team &team, const Point &p, bool out) {
   static const auto &initialDepth = Config::initialDepth();
   static const auto &maxDepth = Config::maxDepth();
   static const auto &divThr = Config::divThr();
+  static const auto &reducedPrecisionDepth = Config::reducedPrecisionDepth();
+  static constexpr uint K = 1 << ESHN_SUBSTRATE_DIMENSION;
 
-  QOTree root = node(Point::null(), 1.f, 1);
-  std::queue<QOTreeNode*> q;
-  q.push(root.get());
+  Workspace &tree = team.workspaces[0];
+  auto &levels = tree.levels;
+  for (auto &l: levels) l.clear();
+  if (levels.empty()) levels.emplace_back();
+  levels[0].push_back({
+    Point::null(), 1.f, NAN, 0, Cell::PENDING, true, -1, 1
+  });
 
-  const auto weight = [&cppn] (const Point &p0, const Point &p1) {
-    return cppn(p0, p1, genotype::cppn::Output::WEIGHT);
-  };
+  tree.self.assign(1, p);
+  const CPPN::Points &self = tree.self;
 
 #ifdef DEBUG_QUADTREE_DIVISION
   std::cout << "divisionAndInitialisation(" << p << ", " << out << ")\n";
 #endif
 
-  while (!q.empty()) {
-    QOTreeNode &n = *q.front();
-    q.pop();
-
-    float cx = n.center.x(), cy = n.center.y();
+  // Cells pending division in a level are in the order in which their
+  // parents were divided, i.e. that of a FIFO. Their children are laid out
+  // in the same order
+  auto &pending = tree.pending;
+  for (uint l=0; l<levels.size(); l++) {
+    pending.clear();
+    for (uint i=0; i<levels[l].size(); i++) {
+      if (levels[l][i].children != Cell::PENDING) continue;
+      levels[l][i].children = K * pending.size();
+      pending.push_back(i);
+    }
+    if (pending.empty())  break;
+
+    const uint level = l+1;
+    if (l+1 == levels.size()) levels.emplace_back();
+    levels[l+1].resize(K * pending.size());
+
+    // The whole level is queried at once (in one contiguous chunk per worker)
+    // and the variances of its cells computed in a single pass
+    const uint P = pending.size(),
+               chunks = team.pool ? std::min(P, team.pool->size()) : 1,
+               chunk = (P + chunks - 1) / chunks;
+    team.run(chunks, [&, l] (uint j, uint w) {
+      const uint begin = j * chunk, end = std::min(P, begin + chunk);
+      Cell *children = levels[l+1].data() + K * begin;
+      CPPN::Points &centers = team.workspaces[w].centers;
+      std::vector<float> &weights = team.workspaces[w].weights;
+
+      centers.clear();
+      for (uint k=begin; k<end; k++) {
+        const Cell &n = levels[l][pending[k]];
+        float cx = n.center.x(), cy = n.center.y();
 #if ESHN_SUBSTRATE_DIMENSION == 3
-    float cz = n.center.z();
+        float cz = n.center.z();
 #endif
-    float hr = .5 * n.radius;
-    float nl = n.level + 1;
+        float hr = .5 * n.radius;
 
-    n.cs.resize(1 << ESHN_SUBSTRATE_DIMENSION);
-    uint i=0;
-    for (int x: {-1,1})
-      for (int y: {-1, 1})
+        for (int x: {-1,1}) {
+          for (int y: {-1, 1}) {
 #if ESHN_SUBSTRATE_DIMENSION == 2
-        n.cs[i++] = node(cx + x * hr, cy + y * hr, hr, nl);
+            centers.push_back({cx + x * hr, cy + y * hr});
 #elif ESHN_SUBSTRATE_DIMENSION == 3
-        for (int z: {-1,1})
-          n.cs[i++] = node(cx + x * hr, cy + y * hr, cz + z * hr, hr, nl);
+            for (int z: {-1,1})
+              centers.push_back({cx + x * hr, cy + y * hr, cz + z * hr});
 #endif
+          }
+        }
+      }
 
-    for (auto &c: n.cs)
-      c->weight = out ? weight(p, c->center) : weight(c->center, p);
+      const CPPN::Points &srcs = out ? self : centers,
+                         &dsts = out ? centers : self;
+      // Coarse weights only feed variance estimates (unless extracted, in
+      // which case they are recomputed): approximate values are good enough
+      // Exact ones come with the LEO output (if equal to its value when
+      // queried alone) to spare a query to most leaves during extraction
+      QueryCache &cppn = team.caches[w];
+      bool exact = (level >= reducedPrecisionDepth),
+           leos = exact && cppn.consistent();
+      const std::vector<float> *leo = nullptr;
+      if (leos) {
+        static const CPPN::OutputSubset oset {
+          genotype::cppn::Output::WEIGHT, genotype::cppn::Output::LEO
+        };
+        auto &outputs = team.workspaces[w].outputs;
+        cppn(srcs, dsts, outputs, oset);
+        weights.swap(outputs[uint(genotype::cppn::Output::WEIGHT)]);
+        leo = &outputs[uint(genotype::cppn::Output::LEO)];
+      } else if (exact)
+        cppn(srcs, dsts, weights, genotype::cppn::Output::WEIGHT);
+      else
+        cppn.reducedPrecision(srcs, dsts, weights,
+                              genotype::cppn::Output::WEIGHT);
+
+      // Cells of a level all have the same radius
+      const float hr = .5 * levels[l][pending[begin]].radius;
+      for (uint i=0; i<centers.size(); i++)
+        children[i] = {centers[i], hr, weights[i], 0, Cell::NONE, exact,
+                       int8_t(leo ? bool((*leo)[i]) : -1), 1};
+
+      for (uint k=begin; k<end; k++) {
+        Cell &n = levels[l][pending[k]], *cs = children + K * (k - begin);
+        const float *w = weights.data() + K * (k - begin);
+        float mean = 0;
+        for (uint i=0; i<K; i++)  mean += w[i];
+        mean /= K;
+        float var = 0;  // squares in double, as with std::pow(float, int)
+        for (uint i=0; i<K; i++) {
+          const double d = w[i] - mean;
+          var += d * d;
+        }
+        n.variance = var / K;
 
 #ifdef DEBUG_QUADTREE_DIVISION
-    std::string indent (2*n.level, ' ');
-    std::cout << indent << n.center << ", r=" << n.radius << ", l=" << n.level
-              << ":";
-    for (auto &c: n.cs) std::cout << " " << c->weight;
-    std::cout << "\n" << indent << "> var = " << n.variance() << "\n";
+        std::string indent (2*level, ' ');
+        std::cout << indent << n.center << ", r=" << n.radius << ", l="
+                  << level << ":";
+        for (uint i=0; i<K; i++) std::cout << " " << w[i];
+        std::cout << "\n" << indent << "> var = " << n.variance << "\n";
 #endif
 
-    if (n.level < initialDepth || (n.level < maxDepth && n.variance() > divThr))
-      for (auto &c: n.cs) q.push(c.get());
+        if (level < initialDepth || (level < maxDepth && n.variance > divThr))
+          for (uint i=0; i<K; i++)  cs[i].children = Cell::PENDING;
+      }
+    });
+  }
+
+  // Pruning keeps the samples of every level alive while exploring deeper
+  for (Workspace *w = team.workspaces;
+       w < team.workspaces + (team.pool ? team.pool->size() : 1); w++) {
+    if (w->samples.size() < levels.size())  w->samples.resize(levels.size());
+    w->lattice.clear();
   }
 
-#if DEBUG_ES_QUADTREE
-  std::cerr << *root;
-#endif
+  // Subtree sizes, to share the pruning
+  if (team.pool)
+    for (uint l=levels.size()-1; l-- > 0; )
+      for (Cell &c: levels[l])
+        if (c.children != Cell::NONE)
+          for (uint i=0; i<K; i++)
+            c.cells += levels[l+1][c.children+i].cells;
 
 #ifdef DEBUG_QUADTREE
-  quadtree_debug::debugGenerateImages(*root, p, !out);
+  quadtree_debug::debugGenerateImages(tree, p, !out);
 #endif
-
-  return root;
 }
 
 struct Connection {
@@ -166,86 +219,198 @@ struct Connection {
   }
 };
 using Connections = std::set<Connection>;//std::vector<Connection>;
-void pruneAndExtract (const CPPN &cppn, const Point &p, Connections &con,
-                      const QOTree &t, bool out) {
+using Subtrees = std::vector<std::pair<uint, uint>>;
+/// Extracts connections from the children of cell i of level l (and their
+/// descendants) in tree, with buffers from scratch
+/// With a non-null subtrees, those of at most grain cells are not explored
+/// but appended to it instead (to be shared among workers)
+void pruneAndExtract (QueryCache &cppn, const Workspace &tree,
+                      Workspace &scratch, const Point &p, Connections &con,
+                      uint l, uint i, bool out,
+                      Subtrees *subtrees = nullptr, uint grain = 0) {
 
   static const auto &varThr = Config::varThr();
   static const auto &bndThr = Config::bndThr();
-  static const auto leo = [] (const auto &cppn, auto i, auto o) {
+  static const auto &intervalPruning = Config::intervalPruning();
+  static const auto &derivativeBand = Config::derivativeBand();
+  static const auto leo = [] (auto &cppn, auto i, auto o) {
     return (bool)cppn(i, o, genotype::cppn::Output::LEO);
   };
 
+  static constexpr uint K = 1 << ESHN_SUBSTRATE_DIMENSION;
+  const Cell &t = tree.levels[l][i];
+  if (t.children == Cell::NONE) return;
+  const Cell *cs = tree.levels[l+1].data() + t.children;
+
 #ifdef DEBUG_QUADTREE_PRUNING
-  if (t->level == 1)  std::cout << "\n---\n";
+  if (l == 0)  std::cout << "\n---\n";
   utils::IndentingOStreambuf indent (std::cout);
-  std::cout << "pruneAndExtract(" << p << ", " << t->center << ", "
-            << t->radius << ", " << t->level << ", " << out << ") {\n";
+  std::cout << "pruneAndExtract(" << p << ", " << t.center << ", "
+            << t.radius << ", " << l+1 << ", " << out << ") {\n";
+#endif
+
+  // Gather band-pruning samples of all non-explored children in one batch
+  // (unless bands are estimated from the weight derivatives), skipping those
+  // already evaluated for this point (e.g. by a neighbor)
+  // Children that cannot be connected (null weight, LEO off) or whose weight
+  // provably varies by less than bndThr over their samples (i.e. not part of
+  // a band) are skipped altogether
+  static constexpr uint S = 2 * ESHN_SUBSTRATE_DIMENSION;
+  const CPPN::Points &self = tree.self;
+  CPPN::Points &samples = scratch.centers;
+  std::vector<float> &weights = scratch.samples[l].weights;
+  std::vector<bool> &skipped = scratch.samples[l].skipped;
+  samples.clear();
+  scratch.slots.clear();
+  scratch.fresh.clear();
+  skipped.assign(K, false);
+  for (uint i=0; i<K; i++) {
+    const Cell &c = cs[i];
+    if (c.variance >= varThr)  continue;
+
+    // Cheapest predicates first (values from the division)
+    if (c.leo == 0 || (c.exact && !derivativeBand && c.weight == 0)) {
+      skipped[i] = true;
+      continue;
+    }
+
+    float r = c.radius;
+    float cx = c.center.x(), cy = c.center.y();
+#if ESHN_SUBSTRATE_DIMENSION == 2
+    std::array<Point, S> csamples {{
+      {cx-r, cy}, {cx+r, cy}, {cx, cy-r}, {cx, cy+r}
+    }};
+#elif ESHN_SUBSTRATE_DIMENSION == 3
+    float cz = c.center.z();
+    std::array<Point, S> csamples {{
+      {cx-r, cy, cz}, {cx+r, cy, cz},
+      {cx, cy-r, cz}, {cx, cy+r, cz},
+      {cx, cy, cz-r}, {cx, cy, cz+r}
+    }};
 #endif
 
-  for (auto &c: t->cs) {
+    // Weight intervals bound the sampled differences, not the estimates of
+    // derivative bands (see below)
+    if (intervalPruning && !derivativeBand) {
+      CPPN::Box box { c.center, c.center }, pbox { p, p };
+      for (const Point &s: csamples) {
+        for (uint d=0; d<ESHN_SUBSTRATE_DIMENSION; d++) {
+          if (s.get(d) < box.min.get(d))  box.min.set(d, s.get(d));
+          if (s.get(d) > box.max.get(d))  box.max.set(d, s.get(d));
+        }
+      }
+      CPPN::Range w = out ? cppn(pbox, box, genotype::cppn::Output::WEIGHT)
+                          : cppn(box, pbox, genotype::cppn::Output::WEIGHT);
+      // Every |c->weight - weight(sample)| <= w.max - w.min <= bndThr
+      if (w.max - w.min <= bndThr) {
+        skipped[i] = true;
+        continue;
+      }
+    }
+
+    if (derivativeBand) continue;
+    for (const Point &s: csamples) {
+      auto r = scratch.lattice.try_emplace(s);
+      if (r.second) {
+        samples.push_back(s);
+        scratch.fresh.push_back(&r.first->second);
+      }
+      scratch.slots.push_back(&r.first->second);
+    }
+  }
+  if (out)
+    cppn(self, samples, scratch.weights, genotype::cppn::Output::WEIGHT);
+  else
+    cppn(samples, self, scratch.weights, genotype::cppn::Output::WEIGHT);
+  for (uint i=0; i<scratch.fresh.size(); i++)
+    *scratch.fresh[i] = scratch.weights[i];
+  weights.resize(scratch.slots.size());
+  for (uint i=0; i<scratch.slots.size(); i++)
+    weights[i] = *scratch.slots[i];
+
+  uint s = 0;
+  for (uint i=0; i<K; i++) {
+    const Cell &c = cs[i];
+    if (skipped[i])  continue;
+
 #ifdef DEBUG_QUADTREE_PRUNING
     utils::IndentingOStreambuf indent1 (std::cout);
-    std::cout << "processing " << c->center << "\n";
+    std::cout << "processing " << c.center << "\n";
     utils::IndentingOStreambuf indent2 (std::cout);
 #endif
 
-    if (c->variance() >= varThr) {
+    if (c.variance >= varThr) {
       // More information at lower resolution -> explore
 #ifdef DEBUG_QUADTREE_PRUNING
-      std::cout << "a> " << c->variance() << " >= " << varThr
+      std::cout << "a> " << c.variance << " >= " << varThr
                 << " >> digging\n";
 #endif
-      pruneAndExtract(cppn, p, con, c, out);
+      if (subtrees && c.cells <= grain)
+        subtrees->emplace_back(l+1, t.children+i);
+      else
+        pruneAndExtract(cppn, tree, scratch, p, con, l+1, t.children+i, out,
+                        subtrees, grain);
 
     } else {
       // Not enough information at lower resolution -> test if part of band
 
-      float r = c->radius;
-      float bnd = 0;
+      float weight, bnd = 0;
+      if (derivativeBand) {
+        // Second-order estimate of min(|w(x-r) - w(x)|, |w(x+r) - w(x)|)
+        // i.e. of min(|a-b|, |a+b|) = ||a| - |b|| with a = r w'(x) and
+        // b = r^2 w''(x) / 2
+        CPPN::Derivatives d;
+        weight = cppn.derivatives(out ? p : c.center, out ? c.center : p,
+                                  genotype::cppn::Output::WEIGHT, !out, d);
+        const float r = c.radius;
+        for (const auto &dd: d) {
+          float a = r * dd.first, b = .5f * r * r * dd.second;
+          bnd = std::max(bnd, std::fabs(std::fabs(a) - std::fabs(b)));
+        }
 
-      float cx = c->center.x(), cy = c->center.y();
-      const auto dweight = [&cppn, &p, &c, out] (auto... coords) {
-        Point src = out ? p : Point{coords...},
-              dst = out ? Point{coords...} : p;
-        return std::fabs(c->weight
-                         - cppn(src, dst, genotype::cppn::Output::WEIGHT));
-      };
+      } else {
+        weight = c.exact ? c.weight
+                         : cppn(out ? p : c.center, out ? c.center : p,
+                                genotype::cppn::Output::WEIGHT);
 
+        const auto dweight = [weight, &weights, s] (uint i) {
+          return std::fabs(weight - weights[s+i]);
+        };
 
 #if ESHN_SUBSTRATE_DIMENSION == 2
-      bnd = std::max(
-        std::min(dweight(cx-r, cy), dweight(cx+r, cy)),
-        std::min(dweight(cx, cy-r), dweight(cx, cy+r))
-      );
+        bnd = std::max(
+          std::min(dweight(0), dweight(1)),
+          std::min(dweight(2), dweight(3))
+        );
 
 #elif ESHN_SUBSTRATE_DIMENSION == 3
-      float cz = c->center.z();
-      bnd = std::max({
-        std::min(dweight(cx-r, cy, cz), dweight(cx+r, cy, cz)),
-        std::min(dweight(cx, cy-r, cz), dweight(cx, cy+r, cz)),
-        std::min(dweight(cx, cy, cz-r), dweight(cx, cy, cz+r))
-      });
+        bnd = std::max({
+          std::min(dweight(0), dweight(1)),
+          std::min(dweight(2), dweight(3)),
+          std::min(dweight(4), dweight(5))
+        });
 
 #endif
+        s += S;
+      }
 
 #ifdef DEBUG_QUADTREE_PRUNING
-      std::cout << "b> var = " << c->variance() << ", bnd = "
-                << std::max(std::min(dl, dr), std::min(dt, db))
-                << " = max(min(" << dl << ", " << dr << "), min(" << dt
-                << ", " << db << ")) && leo = "
-                << leoConnection(cppn, out ? p : c->center, out ? c->center : p)
+      std::cout << "b> var = " << c.variance << ", bnd = " << bnd
+                << " && leo = "
+                << leo(cppn, out ? p : c.center, out ? c.center : p)
                 << "\n";
 #endif
 
-      if (bnd > bndThr
-          && leo(cppn, out ? p : c->center, out ? c->center : p)
-          && c->weight != 0) {
+      if (weight != 0 && bnd > bndThr
+          && (c.leo > 0
+              || (c.leo < 0
+                  && leo(cppn, out ? p : c.center, out ? c.center : p)))) {
         con.insert({
-          out ? p : c->center, out ? c->center : p, c->weight
+          out ? p : c.center, out ? c.center : p, weight
         });
 #ifdef DEBUG_QUADTREE_PRUNING
-        std::cout << " < created " << (out ? p : c->center) << " -> "
-                  << (out ? c->center : p) << " [" << c->weight << "]\n";
+        std::cout << " < created " << (out ? p : c.center) << " -> "
+                  << (out ? c.center : p) << " [" << weight << "]\n";
 #endif
       }
     }
@@ -378,7 +543,41 @@ void collect (const Connections &newConnections, Connections &connections,
   connections.insert(newConnections.begin(), newConnections.end());
 }
 
-bool connect (const CPPN &cppn,
+/// Explores a single point with all the workers of the team
+/// Subtrees small enough are pruned as separate tasks and their connections
+/// merged in the order in which they were found
+void exploreShared (const Point &p, bool out, const Team &team,
+                    Connections &con) {
+  // Subtrees below this size are never worth a task
+  static constexpr uint MIN_TASK_CELLS = 64;
+  // Tasks per worker, for balancing
+  static constexpr uint TASKS_PER_WORKER = 4;
+
+  const uint workers = team.pool->size();
+  team.run(workers, [&] (uint w, uint) {
+    team.caches[w].specialize(p, out);
+  });
+  divisionAndInitialisation(team, p, out);
+
+  Workspace &tree = team.workspaces[0];
+  const uint grain = std::max(MIN_TASK_CELLS,
+                              tree.levels[0][0].cells
+                                / (TASKS_PER_WORKER * workers));
+  Subtrees &subtrees = tree.subtrees;
+  subtrees.clear();
+  pruneAndExtract(team.caches[0], tree, tree, p, con, 0, 0, out,
+                  &subtrees, grain);
+
+  std::vector<Connections> found (subtrees.size());
+  team.run(subtrees.size(), [&] (uint j, uint w) {
+    pruneAndExtract(team.caches[w], tree, team.workspaces[w], p, found[j],
+                    subtrees[j].first, subtrees[j].second, out);
+  });
+  for (Connections &c: found) con.insert(c.begin(), c.end());
+}
+
+/// Caches and builder hold one instance per worker
+bool connect (std::vector<QueryCache> &caches, ESBuilder &builder,
               const Coordinates &inputs, const Coordinates &outputs,
               Coordinates &hidden, Connections &connections) {
 
@@ -414,13 +613,42 @@ bool connect (const CPPN &cppn,
   uint n_hidden = 0, n_connections = 0;
 #endif
 
-  Coordinates_s shidden;
+  // Points are explored independently (in parallel if requested) and their
+  // connections merged in the order of the points: the ANN does not depend
+  // on the number of workers nor on the scheduling
+  // With fewer points than workers, these instead share the quadtree of each
+  // point: levels are divided cell by cell and subtrees pruned independently
+  std::vector<Connections> found;
+  const auto explore = [&caches, &builder, &found] (const Coordinates &points,
+                                                    bool out) {
+    found.assign(points.size(), Connections());
+    ThreadPool *pool = builder.pool.get();
+    if (pool && points.size() < pool->size()) {
+      for (uint i=0; i<points.size(); i++)
+        exploreShared(points[i], out, {caches.data(),
+                                       builder.workspaces.data(), pool},
+                      found[i]);
+
+    } else {
+      const auto task = [&] (uint i, uint w) {
+        const Point &p = points[i];
+        caches[w].specialize(p, out);
+        divisionAndInitialisation({&caches[w], &builder.workspaces[w], nullptr},
+                                  p, out);
+        pruneAndExtract(caches[w], builder.workspaces[w],
+                        builder.workspaces[w], p, found[i], 0, 0, out);
+      };
+      if (pool)
+        pool->run(points.size(), task);
+      else
+        for (uint i=0; i<points.size(); i++)  task(i, 0);
+    }
+  };
 
-  for (const Point &p: inputs) {
-    Connections tmpConnections;
-    auto t = divisionAndInitialisation(cppn, p, true);
-    pruneAndExtract(cppn, p, tmpConnections, t, true);
+  Coordinates_s shidden;
 
+  explore(inputs, true);
+  for (const Connections &tmpConnections: found) {
     Coordinates_s newHiddens;
     collect(tmpConnections, connections, shidden, newHiddens);
   }
@@ -446,12 +674,10 @@ bool connect (const CPPN &cppn,
   for (uint i=0; i<iterations && !converged; i++) {
 
     Coordinates_s newHiddens;
-    for (const Point &p: unexploredHidden) {
-      Connections tmpConnections;
-      auto t = divisionAndInitialisation(cppn, p, true);
-      pruneAndExtract(cppn, p, tmpConnections, t, true);
+    explore(Coordinates(unexploredHidden.begin(), unexploredHidden.end()),
+            true);
+    for (const Connections &tmpConnections: found)
       collect(tmpConnections, connections, shidden, newHiddens);
-    }
 
 //    Coordinates_s tmpHidden;
 //    std::set_difference(shidden.begin(), shidden.end(),
@@ -487,12 +713,9 @@ bool connect (const CPPN &cppn,
     if (overflow(shidden, connections)) return false;
   }
 
-  for (const Point &p: outputs) {
-    Connections tmpConnections;
-    auto t = divisionAndInitialisation(cppn, p, false);
-    pruneAndExtract(cppn, p, tmpConnections, t, false);
+  explore(outputs, false);
+  for (const Connections &tmpConnections: found)
     connections.insert(tmpConnections.begin(), tmpConnections.end());
-  }
 
 #if DEBUG_ES
   oss << "[H -> O] found " << connections.size() - n_connections
@@ -528,25 +751,161 @@ bool connect (const CPPN &cppn,
   return true;
 }
 
+/// Bounds of the LEO and weight outputs over a region of the substrate
+struct Bounds {
+  CPPN::Range leo, weight;
+};
+
+/// Whether no connection can be extracted between p and the cell of the given
+/// level (nor any of its descendants), p being the source if out. Regions at
+/// the probing depth are bounded directly, the coarser ones by the hull of
+/// their children's bounds (returned through b). Band pruning is only taken
+/// into account if bands (i.e. if the fixed point p is explored as such)
+bool unconnectable (const CPPN &cppn, const Point &p, bool out, bool bands,
+                    const Point &center, float radius, uint level, uint depth,
+                    Bounds &b) {
+  static const auto &bndThr = Config::bndThr();
+  static const auto &derivativeBand = Config::derivativeBand();
+  static constexpr uint D = ESHN_SUBSTRATE_DIMENSION;
+  static constexpr uint K = 1 << D;
+  using O = genotype::cppn::Output;
+
+  const auto query = [&cppn, &p, out] (const CPPN::Box &box, O o) {
+    const CPPN::Box pbox { p, p };
+    return out ? cppn(pbox, box, o) : cppn(box, pbox, o);
+  };
+  const auto null = [] (const CPPN::Range &r) {
+    return r.min == 0 && r.max == 0;
+  };
+  const auto hull = [] (const CPPN::Range &a, const CPPN::Range &b) {
+    if (std::isnan(a.min) || std::isnan(b.min)) return CPPN::Range{NAN, NAN};
+    return CPPN::Range{ std::min(a.min, b.min), std::max(a.max, b.max) };
+  };
+  // Holding over a region, these hold for all of its cells: LEO is always
+  // off, weights are null or vary too little for any band
+  const auto proven = [&] (const Bounds &b) {
+    return null(b.leo) || null(b.weight)
+        || (bands && !derivativeBand && b.weight.max - b.weight.min <= bndThr);
+  };
+
+  if (level == depth) {
+    // Centers (and band samples) are rounded to Point's precision at every
+    // level: those of the descendants may stray out of the exact region by
+    // as much as half an epsilon per level
+    const float slack = (Config::maxDepth() + 1) * Point::EPSILON;
+    CPPN::Box box { center, center };
+    for (uint d=0; d<D; d++) {
+      box.min.set(d, center.get(d) - radius - slack);
+      box.max.set(d, center.get(d) + radius + slack);
+    }
+    b = { query(box, O::LEO), query(box, O::WEIGHT) };
+    return proven(b);
+  }
+
+  const float hr = .5 * radius;
+  for (uint i=0; i<K; i++) {
+    Point c = center;
+    for (uint d=0; d<D; d++)
+      c.set(d, center.get(d) + (((i >> d) & 1) ? hr : -hr));
+
+    Bounds cb;
+    if (!unconnectable(cppn, p, out, bands, c, hr, level+1, depth, cb))
+      return false;
+    if (i == 0)
+      b = cb;
+    else
+      b = { hull(b.leo, cb.leo), hull(b.weight, cb.weight) };
+  }
+
+  // Only the descendants of the root are extracted. Otherwise, this cell
+  // cannot be either if its center is not connected
+  if (level == 0 || proven(b))  return true;
+  const CPPN::Box cbox { center, center };
+  return null(query(cbox, O::LEO)) || null(query(cbox, O::WEIGHT));
+}
+
+/// Whether p could be the center of a cell (all coordinates being odd
+/// multiples of the same radius, up to the rounding of centers), i.e. the
+/// target of connections extracted around another point. Errs on the side of
+/// true, which only disables band pruning in unconnectable()
+bool cellCenter (const Point &p) {
+  static const auto &maxDepth = Config::maxDepth();
+  const float slack = (maxDepth + 1) * Point::EPSILON;
+  for (uint l=1; l<=maxDepth; l++) {
+    bool center = true;
+    for (uint d=0; d<ESHN_SUBSTRATE_DIMENSION && center; d++) {
+      const float x = std::ldexp(p.get(d) + 1, l),
+                  odd = 2 * std::floor(.5f * x) + 1;
+      center = (std::fabs(x - odd) <= std::ldexp(slack, l));
+    }
+    if (center) return true;
+  }
+  return false;
+}
+
 } // end of namespace evolvable substrate
 
 bool ANN::empty(void) const {
   return stats().edges == 0;
 }
 
+bool ANN::provablyEmpty (const Coordinates &inputs,
+                         const Coordinates &outputs, const CPPN &cppn) {
+  static const auto &probeDepth = config::EvolvableSubstrate::probeDepth();
+
+  // Remaining connections all go through hidden neurons: some leave an input
+  // (explored as such) and some reach an output (explored as such unless
+  // it is also at the center of a cell)
+  const auto unconnected = [&cppn] (const Coordinates &points, bool out) {
+    for (const Point &p: points) {
+      evolvable_substrate::Bounds b;
+      if (!evolvable_substrate::unconnectable(
+            cppn, p, out, out || !evolvable_substrate::cellCenter(p),
+            Point::null(), 1.f, 0, probeDepth, b))
+        return false;
+    }
+    return true;
+  };
+  return unconnected(inputs, true) || unconnected(outputs, false);
+}
+
 ANN ANN::build (const Coordinates &inputs,
                 const Coordinates &outputs, const CPPN &cppn) {
+  thread_local ESBuilder builder;
+  return build(inputs, outputs, cppn, builder);
+}
+
+ANN ANN::build (const Coordinates &inputs,
+                const Coordinates &outputs, const CPPN &cppn,
+                ESBuilder &builder) {
 
   static const auto& weightRange = config::EvolvableSubstrate::weightRange();
 
+  static const auto& queryCache = config::EvolvableSubstrate::queryCache();
+
+  static const auto& workers = config::EvolvableSubstrate::workers();
+
   ANN ann;
 
   NeuronsMap &neurons = ann._neurons;
 
-  const auto add = [&cppn, &ann] (auto p, auto t) {
+  // One cache and workspace per worker (the first one also serving biases)
+  const uint n = std::max(1u, workers);
+  if (builder.workspaces.size() < n)  builder.workspaces.resize(n);
+  if (n == 1)
+    builder.pool.reset();
+  else if (!builder.pool || builder.pool->size() != n)
+    builder.pool = std::make_unique<ThreadPool>(n);
+
+  std::vector<QueryCache> caches;
+  caches.reserve(n);
+  for (uint w=0; w<n; w++)  caches.emplace_back(cppn, queryCache);
+  QueryCache &cache = caches.front();
+
+  const auto add = [&cache, &ann] (auto p, auto t) {
     float bias = 0;
     if (t != Neuron::I)
-      bias = cppn(p, Point::null(), genotype::cppn::Output::BIAS);
+      bias = cache(p, Point::null(), genotype::cppn::Output::BIAS);
     return ann.addNeuron(p, t, bias);
   };
 
@@ -560,7 +919,7 @@ ANN ANN::build (const Coordinates &inputs,
 
   Coordinates hidden;
   evolvable_substrate::Connections connections;
-  if (evolvable_substrate::connect(cppn, inputs, outputs, hidden,
+  if (evolvable_substrate::connect(caches, builder, inputs, outputs, hidden,
                                    connections)) {
     for (auto &p: hidden) neurons.insert(add(p, Neuron::H));
     for (auto &c: connections)
@@ -568,6 +927,10 @@ ANN ANN::build (const Coordinates &inputs,
   }
 
   ann.computeStats();
+  for (const QueryCache &c: caches) {
+    ann._stats.cacheHits += c.hits();
+    ann._stats.cacheMisses += c.misses();
+  }
 
   return ann;
 }
@@ -770,8 +1133,8 @@ void ANN::reset(void) {
 }
 
 void ANN::operator() (const Inputs &inputs, Outputs &outputs, uint substeps) {
-  static const auto &activation =
-    phenotype::CPPN::functions.at(config::EvolvableSubstrate::activationFunc());
+  const auto activation =
+    activations::function(config::EvolvableSubstrate::activationFunc());
   assert(inputs.size() == _inputs.size());
   assert(outputs.size() == outputs.size());
 
@@ -1257,6 +1620,13 @@ DEFINE_PARAMETER(float, weightRange, 3)
 DEFINE_CONST_PARAMETER(genotype::ES_HyperNEAT::CPPN::Node::FuncID,
                        activationFunc, "ssgn")
 
+DEFINE_PARAMETER(bool, queryCache, true)
+DEFINE_PARAMETER(bool, intervalPruning, true)
+DEFINE_PARAMETER(uint, reducedPrecisionDepth, 0)
+DEFINE_PARAMETER(bool, derivativeBand, false)
+DEFINE_PARAMETER(uint, workers, 1)
+DEFINE_PARAMETER(uint, probeDepth, 2)
+
 DEFINE_PARAMETER(uint, neuronsUpperBound, -1)
 DEFINE_PARAMETER(uint, connectionsUpperBound, -1)
 
@@ -1264,6 +1634,7 @@ DEFINE_PARAMETER(bool, mannWithDepth, false)
 DEFINE_PARAMETER(bool, mannWithSymmetry, false)
 
 DEFINE_SUBCONFIG(genotype::ES_HyperNEAT::config_t, configGenotype)
+DEFINE_SUBCONFIG(config::Activations, configActivations)
 
 #undef CFILE
 
@@ -1280,9 +1651,9 @@ float trunc (float x) {
   return std::round(100 * x) / 100.f;
 }
 
-using QTree = phenotype::evolvable_substrate::QuadTreeNode;
+using QTree = phenotype::ESBuilder::Workspace;
 void debugGenerateImages (const QTree &t,
-                          const phenotype::ANN::Point &p, bool in) {
+                          const phenotype::Point &p, bool in) {
   if (debugFilePrefix().empty())
     throw std::invalid_argument("debug file prefix is empty");
 
@@ -1306,19 +1677,23 @@ void debugGenerateImages (const QTree &t,
       << "\n";
 
 
-  using F = void (*) (std::ostream&, const QTree&);
-  static const F worker = [] (std::ostream &os, const QTree &t) {
-    if (t.cs.empty())
-      os << "  set object rect from " << t.center.x()-t.radius << ","
-         << t.center.y()-t.radius << " to " << t.center.x()+t.radius << ","
-         << t.center.y()+t.radius << " fc palette frac "
-         << (.5*t.weight + .5) << ";\n";
-    else  for (auto &c: t.cs)  worker(os, *c);
+  using F = void (*) (std::ostream&, const QTree&, uint, uint);
+  static const F worker = [] (std::ostream &os, const QTree &t, uint l,
+                              uint i) {
+    const phenotype::ESBuilder::Cell &c = t.levels[l][i];
+    if (c.children == phenotype::ESBuilder::Cell::NONE)
+      os << "  set object rect from " << c.center.x()-c.radius << ","
+         << c.center.y()-c.radius << " to " << c.center.x()+c.radius << ","
+         << c.center.y()+c.radius << " fc palette frac "
+         << (.5*c.weight + .5) << ";\n";
+    else
+      for (uint j=0; j<(1u<<ESHN_SUBSTRATE_DIMENSION); j++)
+        worker(os, t, l+1, c.children+j);
   };
 //  oss << "  set object rect from -1,-1 to 0,0 fc palette frac 0.0;\n";
 //  oss << "  set object rect from 0,0 to 1,1 fc palette frac 0.5;\n";
 //  oss << "  set object rect from -1,0 to 0,1 fc palette frac 1.0;\n";
-  worker(oss, t);
+  worker(oss, t, 0, 0);
 
   oss << "  \nplot x linecolor '#FF000000' notitle;\"";
 
@@ -2,6 +2,7 @@
 #define KGD_ANN_PHENOTYPE_H
 
 #include "cppn.h"
+#include "threadpool.h"
 
 //#define DEBUG_QUADTREE
 #ifdef DEBUG_QUADTREE
@@ -12,6 +13,68 @@ const stdfs::path& debugFilePrefix (const stdfs::path &path = "");
 
 namespace phenotype {
 
+/// Scratch memory for the evolvable substrate part of ANN::build
+/// Quadtrees (octrees in 3D) are stored level by level in contiguous buffers
+/// which, like the query buffers, keep their capacity across points and
+/// builds: once warmed up, exploring a point does not allocate (beyond the
+/// CPPN queries and the connections found). Also holds the threads exploring
+/// points in parallel (see config::EvolvableSubstrate::workers) or, when
+/// there are fewer points than workers, the cells and subtrees of a single
+/// quadtree. One per thread calling ANN::build
+struct ESBuilder {
+  /// Cell of a quadtree, with its (first) children in the next level
+  struct Cell {
+    static constexpr uint NONE = uint(-1);    ///< Leaf
+    static constexpr uint PENDING = uint(-2); ///< Yet to be divided
+
+    Point center;
+    float radius;
+    float weight;
+    float variance; ///< Of the children's weights (0 for leaves)
+    uint children;  ///< Index of the first one in the next level
+    bool exact;     ///< Whether weight was computed at full precision
+    int8_t leo;     ///< LEO output, from the same query (-1 if unknown)
+    uint cells;     ///< In the subtree (when explored by several workers)
+  };
+
+  /// Buffers of one worker
+  struct Workspace {
+    /// Cells of the current quadtree, level by level (the root being alone
+    /// in the first one). Children of a cell are contiguous
+    std::vector<std::vector<Cell>> levels;
+
+    /// Band-pruning samples of one level's children (alive while deeper
+    /// levels are explored)
+    struct Samples {
+      std::vector<float> weights;
+      std::vector<bool> skipped;
+    };
+    std::vector<Samples> samples;
+
+    /// Weights of the band-pruning samples already evaluated for the current
+    /// point. Neighboring cells share half of theirs
+    std::unordered_map<Point, float> lattice;
+
+    /// Where to find (or store) the weights of a batch of samples
+    std::vector<float*> slots, fresh;
+
+    /// Queries of the children's weights (or of unknown samples)
+    std::vector<Point> self, centers;
+    std::vector<float> weights;
+    CPPN::BatchOutputs outputs;
+
+    /// Cells of the level being divided
+    std::vector<uint> pending;
+
+    /// Roots (level, index) of the subtrees pruned by other workers
+    std::vector<std::pair<uint, uint>> subtrees;
+  };
+  std::vector<Workspace> workspaces;
+
+  /// Created when more than one worker is requested
+  std::unique_ptr<ThreadPool> pool;
+};
+
 class ANN : public gvc::Graph {
 public:
   static constexpr auto DIMENSIONS = CPPN::DIMENSIONS;
@@ -100,9 +163,25 @@ public:
   void copyInto (ANN &that) const;
 
   using Coordinates = std::vector<Point>;
+
+  /// Builds the ANN of the given CPPN, reusing the workspace of the calling
+  /// thread (see ESBuilder)
   static ANN build (const Coordinates &inputs,
                     const Coordinates &outputs, const phenotype::CPPN &cppn);
 
+  /// Same as above, using (and warming up) the provided workspace
+  static ANN build (const Coordinates &inputs,
+                    const Coordinates &outputs, const phenotype::CPPN &cppn,
+                    ESBuilder &builder);
+
+  /// Whether building from these arguments is certain to produce an empty
+  /// ANN, as proven by interval bounds on the CPPN over a regular grid of the
+  /// substrate (see config::EvolvableSubstrate::probeDepth). Much cheaper
+  /// than a build but false only means unknown
+  static bool provablyEmpty (const Coordinates &inputs,
+                             const Coordinates &outputs,
+                             const phenotype::CPPN &cppn);
+
   friend void to_json (nlohmann::json &j, const ANN &ann);
   friend void from_json (const nlohmann::json &j, ANN &ann);
 
@@ -138,6 +217,9 @@ private:
     uint depth;
     uint edges;
     float axons;  // total length
+
+    // CPPN queries during build
+    uint cacheHits = 0, cacheMisses = 0;
   } _stats;
 
   Neuron::ptr addNeuron (const Point &p, Neuron::Type t, float bias);
@@ -223,6 +305,13 @@ struct CONFIG_FILE(EvolvableSubstrate) {
   DECLARE_CONST_PARAMETER(genotype::ES_HyperNEAT::CPPN::Node::FuncID,
                           activationFunc)
 
+  DECLARE_PARAMETER(bool, queryCache)  // memoize CPPN queries during build
+  DECLARE_PARAMETER(bool, intervalPruning)  // skip provably flat cells
+  DECLARE_PARAMETER(uint, reducedPrecisionDepth)  // coarse divisions approx.
+  DECLARE_PARAMETER(bool, derivativeBand)  // band from weight derivatives
+  DECLARE_PARAMETER(uint, workers)  // threads exploring points (see ESBuilder)
+  DECLARE_PARAMETER(uint, probeDepth)  // resolution of ANN::provablyEmpty
+
   DECLARE_PARAMETER(uint, neuronsUpperBound)
   DECLARE_PARAMETER(uint, connectionsUpperBound)
 
@@ -230,6 +319,7 @@ struct CONFIG_FILE(EvolvableSubstrate) {
   DECLARE_PARAMETER(bool, mannWithSymmetry)
 
   DECLARE_SUBCONFIG(genotype::ES_HyperNEAT::config_t, configGenotype)
+  DECLARE_SUBCONFIG(config::Activations, configActivations)
 };
 
 } // end of namespace config
@@ -1,6 +1,9 @@
+#include <algorithm>
 #include <cmath>
+#include <sstream>
 
 #include "cppn.h"
+#include "fmath.h"
 
 namespace phenotype {
 
@@ -8,25 +11,6 @@ namespace phenotype {
 //#define DEBUG
 #endif
 
-// =============================================================================
-// -- Ugly solution to numerical non-determinism
-// Divergences observed on local/remote machines can be solved by requesting
-//  value in double precision (accurate within 1ULP?) and truncating back to
-//  float. Computationally more expensive but ensures bitwise identical CPPN/ANN
-
-float fd_exp(float x) {
-  return static_cast<double(*)(double)>(std::exp)(x);
-}
-
-float fd_sin(float x) {
-  return static_cast<double(*)(double)>(std::sin)(x);
-}
-
-#define KGD_EXP fd_exp
-#define KGD_EXP_STR "dexp"
-
-// =============================================================================
-
 float ssgn(float x) {
   static constexpr float a = 1;
   return x < -a ? KGD_EXP(-(x+a)*(x+a))-1
@@ -42,9 +26,9 @@ float act2(float x) {
 }
 
 #define F(NAME, BODY) \
- { NAME, [] (float x) -> float { return BODY; } }
-const std::map<genotype::ES_HyperNEAT::CPPN::Node::FuncID,
-               CPPN::Function> CPPN::functions {
+ { FuncID::NAME, [] (float x) -> float { return BODY; } }
+const CPPN::FunctionArray<CPPN::Function> CPPN::functions =
+  genotype::cppn::functionArray<CPPN::Function>({
 
   // Function set from Risi
 //  F("line", std::fabs(x)),  // Described as "linear"
@@ -56,13 +40,13 @@ const std::map<genotype::ES_HyperNEAT::CPPN::Node::FuncID,
 //  F("step", x < 0 ? 0 : 1),
 
   // Personal take on the function set
-  F( "abs", std::fabs(x)),
-  F("gaus", KGD_EXP(-6.25f*x*x)), // Same steepness as Risi's but positive
-  F(  "id", x),
-  F("ssgm", 1.f / (1.f + KGD_EXP(-4.9f*x))),
-  F("bsgm", 2.f / (1.f + KGD_EXP(-4.9f*x)) - 1.f),
-  F( "sin", fd_sin(2.f*x)),
-  F("step", x <= 0.f ? 0.f : 1.f),
+  F( ABS, std::fabs(x)),
+  F(GAUS, KGD_EXP(-6.25f*x*x)), // Same steepness as Risi's but positive
+  F(  ID, x),
+  F(SSGM, 1.f / (1.f + KGD_EXP(-4.9f*x))),
+  F(BSGM, 2.f / (1.f + KGD_EXP(-4.9f*x)) - 1.f),
+  F( SIN, KGD_SIN(2.f*x)),
+  F(STEP, x <= 0.f ? 0.f : 1.f),
 
   // Custom-made activation function
   // kact(-inf) = 0, kact(0) = 0, kact(+inf) = 1
@@ -70,29 +54,29 @@ const std::map<genotype::ES_HyperNEAT::CPPN::Node::FuncID,
 //  F("kact", x < 0 ? 4.f * x / (1.f + std::exp(-4*x)) : std::tanh(2*x)),
 
   // Another custom-made activation function
-  F("ssgn", ssgn(x)),
+  F(SSGN, ssgn(x)),
 
   // Positive activation function
   // forall x <=0, act2(x) = 0
   // lim x -> inf act2(x) = 1
 //  F("act2", act2(x)),
-};
+});
 #undef F
 
-template <typename K, typename V>
-std::map<V, K> reverse (const std::map<K, V> &m) {
-  std::map<V, K> m_;
-  for (const auto &p: m) m_.emplace(p.second, p.first);
-  return m_;
+template <typename V>
+std::map<V, CPPN::FuncID> reverse (const CPPN::FunctionArray<V> &a) {
+  std::map<V, CPPN::FuncID> m;
+  for (uint i=0; i<a.size(); i++) m.emplace(a[i], CPPN::FuncID::Value(i));
+  return m;
 }
 
-const std::map<CPPN::Function, genotype::ES_HyperNEAT::CPPN::Node::FuncID>
+const std::map<CPPN::Function, CPPN::FuncID>
   CPPN::functionToName = reverse(CPPN::functions);
 
 
-#define F(NAME, MIN, MAX) { NAME, { MIN, MAX }}
-const std::map<genotype::ES_HyperNEAT::CPPN::Node::FuncID,
-               CPPN::Range> CPPN::functionRanges {
+#define F(NAME, MIN, MAX) { FuncID::NAME, { MIN, MAX }}
+const CPPN::FunctionArray<CPPN::Range> CPPN::functionRanges =
+  genotype::cppn::functionArray<CPPN::Range>({
 
   // Risi function set bounds
 //  F("line",  0, 1),
@@ -101,21 +85,127 @@ const std::map<genotype::ES_HyperNEAT::CPPN::Node::FuncID,
 //  F("bsgm", -1, 1),
 //  F( "sin", -1, 1),
 
-  F( "abs",  0, 1),
-  F("gaus",  0, 1),
-  F(  "id", -1, 1),
-  F("ssgm",  0, 1),
-  F("bsgm", -1, 1),
-  F( "sin", -1, 1),
-  F("step",  0, 1),
+  F( ABS,  0, 1),
+  F(GAUS,  0, 1),
+  F(  ID, -1, 1),
+  F(SSGM,  0, 1),
+  F(BSGM, -1, 1),
+  F( SIN, -1, 1),
+  F(STEP,  0, 1),
+  F(SSGN, -1, 1),
 
 //  F("kact", -1, 1), // Not really (min value ~ .278)
-};
+});
 #undef F
 
-CPPN::CPPN (void){}
+CPPN::CPPN (void) : _bufferSize(0), _acyclic(true), _simplification{} {}
+
+struct CPPN::GNode {
+  NodeID id;
+  FuncID fid;
+  Function func;
+  activations::Kernel kernel, reduced;
+  activations::IntervalFunction bounds;
+  activations::DerivativesFunction derivatives;
+  std::vector<Link> links;
+  enum { UNVISITED, ACTIVE, DONE } state;
+};
+
+void CPPN::simplify (std::vector<GNode> &graph) {
+  static constexpr uint IO = INPUTS + OUTPUTS;
+  const auto hidden = [] (uint i) { return i >= IO; };
+
+  // Depth-first traversal from the outputs (in order). Returns whether a
+  // cycle was found and fills the post-order (i.e. topological order if
+  // acyclic). Unreachable nodes are left UNVISITED
+  std::vector<uint> order;
+  const auto traverse = [&graph, &order] {
+    order.clear();
+    for (GNode &n: graph) n.state = GNode::UNVISITED;
+    bool cycle = false;
+    std::function<void(uint)> visit = [&] (uint i) {
+      graph[i].state = GNode::ACTIVE;
+      for (const Link &l: graph[i].links) {
+        GNode &src = graph[l.src];
+        if (src.state == GNode::ACTIVE) cycle = true;
+        else if (src.state == GNode::UNVISITED) visit(l.src);
+      }
+      graph[i].state = GNode::DONE;
+      order.push_back(i);
+    };
+    for (uint o=INPUTS; o<IO; o++)
+      if (graph[o].state == GNode::UNVISITED) visit(o);
+    return cycle;
+  };
+  const auto isZero = [] (const Link &l) { return l.weight == 0; };
+  if (!traverse()) {
+    // Values are independent from the evaluation order: only the (exact)
+    // arithmetic matters. Every value read is finite and never -0 (sums start
+    // at +0 and no activation function maps +0 to -0) so that adding a null
+    // product, replacing u * (+/-x) by (-/+u) * x or sharing two identical
+    // sums all leave outputs bitwise unchanged
+    for (GNode &n: graph)
+      n.links.erase(std::remove_if(n.links.begin(), n.links.end(), isZero),
+                    n.links.end());
+    traverse();
+
+    // Nodes are replaced by a (source, factor) alias if they compute
+    //  - id(+/-x) with a single link
+    //  - the same function of the same (ordered) links as an earlier node
+    std::vector<Link> alias (graph.size());
+    for (uint i=0; i<graph.size(); i++) alias[i] = { 1, i };
+    std::map<std::pair<FuncID, std::vector<std::pair<uint, float>>>, uint>
+      sums;
+    for (uint i: order) {
+      GNode &n = graph[i];
+      std::vector<std::pair<uint, float>> key;
+      for (Link &l: n.links) {
+        const Link &a = alias[l.src];
+        l = { a.weight * l.weight, a.src };
+        key.push_back({l.src, l.weight});
+      }
+      if (!hidden(i)) continue;
+
+      if (n.fid == FuncID::ID && n.links.size() == 1
+          && std::fabs(n.links.front().weight) == 1)
+        alias[i] = n.links.front();
+      else {
+        auto r = sums.try_emplace({n.fid, key}, i);
+        if (!r.second)  alias[i] = { 1, r.first->second };
+      }
+    }
 
-CPPN CPPN::fromGenotype(const genotype::ES_HyperNEAT &es_hyperneat) {
+  } else {
+    // Recurrent links read partial sums: the evaluation order must be kept.
+    // Inputs are never visited and null contributions thereof can go
+    const auto isZeroInput = [isZero] (const Link &l) {
+      return isZero(l) && l.src < INPUTS;
+    };
+    for (GNode &n: graph)
+      n.links.erase(std::remove_if(n.links.begin(), n.links.end(),
+                                   isZeroInput),
+                    n.links.end());
+  }
+
+  // Compact the buffer to the hidden nodes reachable from the outputs
+  traverse();
+  std::vector<uint> indices (graph.size(), 0);
+  uint size = IO;
+  for (uint i=0; i<IO; i++) indices[i] = i;
+  for (uint i=IO; i<graph.size(); i++)
+    if (graph[i].state == GNode::DONE)  indices[i] = size++;
+
+  std::vector<GNode> compact (size);
+  for (uint i=0; i<graph.size(); i++) {
+    if (hidden(i) && graph[i].state != GNode::DONE) continue;
+    GNode &n = compact[indices[i]] = std::move(graph[i]);
+    for (Link &l: n.links)  l.src = indices[l.src];
+  }
+  graph = std::move(compact);
+}
+
+CPPN CPPN::fromGenotype(const genotype::ES_HyperNEAT &es_hyperneat,
+                        bool simplified) {
   using CPPN_g = genotype::ES_HyperNEAT::CPPN;
   const CPPN_g &cppn_g = es_hyperneat.cppn;
   using NID = CPPN_g::Node::ID;
@@ -124,61 +214,124 @@ CPPN CPPN::fromGenotype(const genotype::ES_HyperNEAT &es_hyperneat) {
     return genotype::ES_HyperNEAT::config_t::cppnOutputFuncs()[index];
   };
 
-  CPPN cppn;
-
-  auto fnode = [] (const CPPN_g::Node::FuncID &fid) {
-    return std::make_shared<FNode>(functions.at(fid));
-  };
-
-  std::map<NID, Node_ptr> nodes;
+  // Intermediate graph (buffer indices and genotype-ordered links)
+  std::vector<GNode> graph (INPUTS + OUTPUTS + cppn_g.nodes.size());
+  std::map<NID, uint> indices;
 
-  cppn._inputs.resize(CPPN_g::INPUTS);
-  for (uint i=0; i<CPPN_g::INPUTS; i++) {
+  for (uint i=0; i<INPUTS; i++) {
 #ifdef DEBUG
     std::cerr << "(I) " << NID(i) << " " << i << std::endl;
 #endif
-    nodes[NID(i)] = cppn._inputs[i] = std::make_shared<INode>();
+    indices[NID(i)] = i;
+    graph[i].id = NID(i);
   }
 
-  cppn._outputs.resize(CPPN_g::OUTPUTS);
-  for (uint i=0; i<CPPN_g::OUTPUTS; i++) {
+  for (uint i=0; i<OUTPUTS; i++) {
 #ifdef DEBUG
-    std::cerr << "(O) " << NID(i+CPPN_g::INPUTS) << " " << i << " "
+    std::cerr << "(O) " << NID(i+INPUTS) << " " << i << " "
               << ofuncs(i) << std::endl;
 #endif
-    nodes[NID(i+CPPN_g::INPUTS)] = cppn._outputs[i] = fnode(ofuncs(i));
+    indices[NID(i+INPUTS)] = i+INPUTS;
+    graph[i+INPUTS].id = NID(i+INPUTS);
+    graph[i+INPUTS].fid = ofuncs(i);
+    graph[i+INPUTS].func = activations::function(ofuncs(i));
+    graph[i+INPUTS].kernel = activations::kernel(ofuncs(i));
+    graph[i+INPUTS].reduced = activations::reducedKernel(ofuncs(i));
+    graph[i+INPUTS].bounds = activations::bounds(ofuncs(i));
+    graph[i+INPUTS].derivatives = activations::derivatives(ofuncs(i));
   }
 
-  uint i=0;
-  cppn._hidden.resize(cppn_g.nodes.size());
+  uint i = INPUTS + OUTPUTS;
   for (const CPPN_g::Node &n_g: cppn_g.nodes) {
 #ifdef DEBUG
     std::cerr << "(H) " << n_g.id << " " << i << " " << n_g.func << std::endl;
 #endif
-    nodes[n_g.id] = cppn._hidden[i++] = fnode(n_g.func);
+    graph[i].id = n_g.id;
+    graph[i].fid = n_g.func;
+    graph[i].func = activations::function(n_g.func);
+    graph[i].kernel = activations::kernel(n_g.func);
+    graph[i].reduced = activations::reducedKernel(n_g.func);
+    graph[i].bounds = activations::bounds(n_g.func);
+    graph[i].derivatives = activations::derivatives(n_g.func);
+    indices[n_g.id] = i++;
   }
 
   for (const CPPN_g::Link &l_g: cppn_g.links) {
-    FNode &n = dynamic_cast<FNode&>(*nodes.at(l_g.nid_dst));
-    n.links.push_back({l_g.weight, nodes.at(l_g.nid_src)});
+    uint dst = indices.at(l_g.nid_dst);
+    assert(dst >= INPUTS);
+    graph[dst].links.push_back({l_g.weight, indices.at(l_g.nid_src)});
   }
 
+  CPPN cppn;
+  cppn._simplification.before = { uint(cppn_g.nodes.size()),
+                                  uint(cppn_g.links.size()) };
+  if (simplified) simplify(graph);
+  Size &after = cppn._simplification.after;
+  after = { uint(graph.size() - INPUTS - OUTPUTS), 0 };
+  for (const GNode &n: graph) after.links += n.links.size();
+  for (const GNode &n: graph) cppn._ids.push_back(n.id);
+
+  // Flatten the recursive evaluation (depth-first, memoized) for every output
+  // subset. Evaluation order (and thus, for recurrent CPPNs, the values) is
+  // exactly that of a lazy evaluation of the requested outputs in order
+  for (uint mask = 1; mask < cppn._programs.size(); mask++) {
+    Program &p = cppn._programs[mask];
+    for (GNode &n: graph) n.state = GNode::UNVISITED;
+
+    using Visitor = std::function<void(uint)>;
+    Visitor visit = [&cppn, &graph, &p, &visit] (uint index) {
+      GNode &n = graph[index];
+      n.state = GNode::ACTIVE;
+
+      Node chunk {
+        index, n.fid, n.func, n.kernel, n.reduced, n.bounds, n.derivatives,
+        uint(p.links.size()), 0, true, 0.f, false
+      };
+      const auto flush = [&p, &chunk] {
+        chunk.lend = p.links.size();
+        if (chunk.reset || chunk.lbegin < chunk.lend) p.nodes.push_back(chunk);
+        chunk.reset = false;
+      };
+
+      for (const Link &l: n.links) {
+        GNode &src = graph[l.src];
+        bool recurse = (l.src >= INPUTS && src.state == GNode::UNVISITED);
+        if (src.state == GNode::ACTIVE)  cppn._acyclic = false;
+        if (recurse || l.src == index) {
+          // Make the partial sum visible before it is read
+          flush();
+          if (recurse)  visit(l.src);
+          chunk.lbegin = p.links.size();
+        }
+        p.links.push_back(l);
+      }
+
+      chunk.apply = true;
+      chunk.lend = p.links.size();
+      p.nodes.push_back(chunk);
+      n.state = GNode::DONE;
+    };
+
+    for (uint o=0; o<OUTPUTS; o++)
+      if ((mask & (1u << o)) && graph[o+INPUTS].state == GNode::UNVISITED)
+        visit(o+INPUTS);
+
+    p.updateInputs();
+  }
+
+  cppn._bufferSize = graph.size();
+
 #ifdef DEBUG
-  i=0;
-  std::map<Node_ptr, uint> map;
   printf("Built CPPN:\n");
-  for (const auto &v: {cppn._inputs, cppn._outputs, cppn._hidden})
-    for (const Node_ptr &n: v)
-      map[n] = i++;
-
-  for (const auto &v: {cppn._hidden, cppn._outputs}) {
-    for (const Node_ptr &n: v) {
-      FNode &fn = *static_cast<FNode*>(n.get());
-      printf("\t[%d]\n", map.at(n));
-      std::string fname (functionToName.at(fn.func));
-      printf("\t\t%s\n", fname.c_str());
-      for (const Link &l: fn.links)
-        printf("\t\t[%d]\t%g %a\n", map.at(l.node.lock()), l.weight, l.weight);
+  for (uint mask = 1; mask < cppn._programs.size(); mask++) {
+    const Program &p = cppn._programs[mask];
+    printf("\t[mask %d]\n", mask);
+    for (const Node &n: p.nodes) {
+      printf("\t\t[%d] %s%s%s\n", n.index, n.reset ? "" : "+",
+             n.fid.name(), n.apply ? "" : " (partial)");
+      for (uint i=n.lbegin; i<n.lend; i++)
+        printf("\t\t\t[%d]\t%g %a\n", p.links[i].src, p.links[i].weight,
+               p.links[i].weight);
     }
   }
 #endif
@@ -186,40 +339,211 @@ CPPN CPPN::fromGenotype(const genotype::ES_HyperNEAT &es_hyperneat) {
   return cppn;
 }
 
-float CPPN::INode::value (void) {
-#ifdef DEBUG
-  utils::IndentingOStreambuf indent (std::cout);
-  std::cout << "I: " << data << std::endl;
-#endif
-  return data;
+void CPPN::Program::updateInputs (void) {
+  inputs = 0;
+  for (const Link &l: links)
+    if (l.src < INPUTS)  inputs |= 1u << l.src;
 }
 
-float CPPN::FNode::value (void) {
-#ifdef DEBUG
-  utils::IndentingOStreambuf indent (std::cout);
-  std::cout << "F:\n";
-#endif
-  if (std::isnan(data)) {
-    data = 0;
-    for (Link &l: links)
-      data += l.weight * l.node.lock()->value();
+CPPN CPPN::specialize (const Point &p, bool source) const {
+  CPPN s;
+  s._acyclic = _acyclic;
+  s._bufferSize = _bufferSize;
+  s._simplification = _simplification;
+
+  for (uint mask = 1; mask < _programs.size(); mask++) {
+    const Program &fp = _programs[mask];
+    Program &sp = s._programs[mask];
+
+    // Replay the evaluation on the fixed inputs, tracking which values of the
+    // buffer are known at each step
+    std::vector<float> values (_bufferSize, NAN);
+    std::vector<bool> known (_bufferSize, false);
+    const uint offset = source ? 0 : DIMENSIONS;
+    for (uint i=0; i<DIMENSIONS; i++) {
+      values[offset+i] = p.get(i);
+      known[offset+i] = true;
+    }
+    values[INPUTS-1] = 1;
+    known[INPUTS-1] = true;
+
+    // Known values read by residual nodes are copied in dedicated slots (the
+    // original may still be modified later on by a recurrent connection)
+    std::map<uint, uint> slots;
+    uint size = _bufferSize;
+    const auto slot = [&] (uint index) {
+      auto it = slots.find(index);
+      if (it == slots.end()) {
+        it = slots.emplace(index, size++).first;
+        sp.constants.push_back({it->second, values[index]});
+      }
+      return it->second;
+    };
+
+    for (const Node &n: fp.nodes) {
+      bool k = n.reset || known[n.index];
+      float v = n.reset ? n.init : values[n.index];
+
+      uint i = n.lbegin;
+      for (; k && i<n.lend && known[fp.links[i].src]; i++)
+        v += fp.links[i].weight * values[fp.links[i].src];
+
+      if (k && i == n.lend) {
+        values[n.index] = n.apply ? n.func(v) : v;
+        known[n.index] = true;
+        slots.erase(n.index);
+        continue;
+      }
+
+      Node r = n;
+      if (k) {
+        r.reset = true;
+        r.init = v;
+      }
+      r.lbegin = sp.links.size();
+      for (; i<n.lend; i++) {
+        Link l = fp.links[i];
+        if (known[l.src])  l.src = slot(l.src);
+        sp.links.push_back(l);
+      }
+      r.lend = sp.links.size();
+      sp.nodes.push_back(r);
+      known[n.index] = false;
+    }
+
+    // Constant outputs are never written by the residual program
+    for (uint o=0; o<OUTPUTS; o++)
+      if ((mask & (1u << o)) && known[o+INPUTS])
+        sp.constants.push_back({o+INPUTS, values[o+INPUTS]});
+
+    sp.updateInputs();
+    s._bufferSize = std::max(s._bufferSize, size);
+  }
+
+  return s;
+}
+
+// =============================================================================
+
+namespace {
+
+/// Exact C++ representation of a float
+std::string literal (float f) {
+  if (std::isnan(f))  return "__builtin_nanf(\"\")";
+  if (std::isinf(f))  return f < 0 ? "-__builtin_inff()" : "__builtin_inff()";
+  std::ostringstream oss;
+  oss << std::hexfloat << f << "f";
+  return oss.str();
+}
+
+} // end of anonymous namespace
+
+std::string CPPN::Program::source (const std::string &name, uint bufferSize,
+                                   std::vector<Function> &functions) const {
+  // Buffer values live in locals: loaded if read before being written (e.g.
+  // through a recurrent connection) and stored back once done so that the
+  // buffer ends up exactly as with the interpreter
+  std::vector<bool> loaded (bufferSize, false), written (bufferSize, false);
+  const auto var = [] (uint i) { return "x" + std::to_string(i); };
+  const auto read = [&loaded, &written, &var] (uint i) {
+    if (!written[i])  loaded[i] = true;
+    return var(i);
+  };
+
+  functions.clear();
+  const auto fid = [&functions] (Function f) {
+    auto it = std::find(functions.begin(), functions.end(), f);
+    if (it == functions.end())  it = functions.insert(it, f);
+    return std::to_string(it - functions.begin());
+  };
+
+  std::ostringstream body;
+  for (const Constant &c: constants) {
+    body << "  " << var(c.index) << " = " << literal(c.value) << ";\n";
+    written[c.index] = true;
+  }
+
+  for (const Node &n: nodes) {
+    body << "  v = " << (n.reset ? literal(n.init) : read(n.index)) << ";\n";
+    for (uint i=n.lbegin; i<n.lend; i++)
+      body << "  v += " << literal(links[i].weight) << " * "
+           << read(links[i].src) << ";\n";
+    body << "  " << var(n.index) << " = ";
+    if (n.apply)  body << "f[" << fid(n.func) << "](v);\n";
+    else          body << "v;\n";
+    written[n.index] = true;
+  }
+
+  std::ostringstream oss;
+  oss << "extern \"C\" void " << name << " (float *d, const F *f) {\n"
+      << "  float v;\n";
+  for (uint i=0; i<bufferSize; i++) {
+    if (!loaded[i] && !written[i])  continue;
+    oss << "  float " << var(i);
+    if (loaded[i])  oss << " = d[" << i << "]";
+    oss << ";\n";
+  }
+  oss << body.str();
+  for (uint i=0; i<bufferSize; i++)
+    if (written[i]) oss << "  d[" << i << "] = " << var(i) << ";\n";
+  oss << "}\n\n";
+  return oss.str();
+}
+
+bool CPPN::compile (void) {
+  std::ostringstream source;
+  source << "// Generated by phenotype::CPPN::compile\n\n"
+         << "using F = float (*) (float);\n\n";
+
+  std::array<std::vector<Function>, 1u << OUTPUTS> functions;
+  const auto name = [] (uint mask) {
+    return "eshn_cppn_" + std::to_string(mask);
+  };
+  for (uint mask = 1; mask < _programs.size(); mask++)
+    source << _programs[mask].source(name(mask), _bufferSize,
+                                     functions[mask]);
+
+  native::Library library = native::load(source.str());
+  if (!library) return false;
+
+  std::array<Program::Native, 1u << OUTPUTS> natives {};
+  for (uint mask = 1; mask < _programs.size(); mask++) {
+    natives[mask] = reinterpret_cast<Program::Native>(
+                      native::symbol(library, name(mask)));
+    if (!natives[mask]) return false;
+  }
+
+  for (uint mask = 1; mask < _programs.size(); mask++) {
+    _programs[mask].native = natives[mask];
+    _programs[mask].functions = functions[mask];
+  }
+  _library = library;
+  return true;
+}
+
+void CPPN::evaluate (const Program &p, Context &context) {
+  float *data = context.data.data();
+  if (p.native) {
+    p.native(data, p.functions.data());
+    return;
+  }
+
+  for (const Constant &c: p.constants)  data[c.index] = c.value;
+  for (const Node &n: p.nodes) {
+    float v = n.reset ? n.init : data[n.index];
+    for (uint i=n.lbegin; i<n.lend; i++) {
+      const Link &l = p.links[i];
+      v += l.weight * data[l.src];
+    }
 
 #ifdef DEBUG
-    auto val = func(data);
-    std::cout << val << " = " << functionToName.at(func)
-              << "(" << data << ")\n";
-    data = val;
-#else
-    data = func(data);
+    if (n.apply)
+      std::cout << n.func(v) << " = " << n.fid
+                << "(" << v << ")\n";
 #endif
 
-#ifdef DEBUG
-  } else
-    std::cout << data << "\n";
-#else
+    data[n.index] = n.apply ? n.func(v) : v;
   }
-#endif
-  return data;
 }
 
 std::ostream& operator<< (std::ostream &os, const std::vector<float> &v) {
@@ -228,36 +552,53 @@ std::ostream& operator<< (std::ostream &os, const std::vector<float> &v) {
   return os << " ]";
 }
 
-void CPPN::pre_evaluation(const Point &src, const Point &dst) const {
+void CPPN::pre_evaluation(const Program &p,
+                          const Point &src, const Point &dst,
+                          Context &context) const {
   static constexpr auto N = DIMENSIONS;
-  for (uint i=0; i<N; i++)  _inputs[i]->data = src.get(i);
-  for (uint i=0; i<N; i++)  _inputs[i+N]->data = dst.get(i);
+  const auto used = [&p] (uint i) { return p.inputs & (1u << i); };
+  auto &data = context.data;
+  data.resize(_bufferSize, NAN);
+  for (uint i=0; i<N; i++)  if (used(i))    data[i] = src.get(i);
+  for (uint i=0; i<N; i++)  if (used(i+N))  data[i+N] = dst.get(i);
 
 #if ESHN_WITH_DISTANCE
   static const float norm = 2*std::sqrt(2);
-  _inputs[2*N]->data = (src - dst).length() / norm;
+  if (used(2*N))  data[2*N] = (src - dst).length() / norm;
 #endif
 
-  _inputs.back()->data = 1;
-
-  for (auto &n: _hidden)  n->data = NAN;
-  for (auto &n: _outputs)  n->data = NAN;
+  data[INPUTS-1] = 1;
 
 #ifdef DEBUG
   utils::IndentingOStreambuf indent (std::cout);
   std::cout << "compute step\n\tInputs:"
             << std::setprecision(std::numeric_limits<float>::max_digits10);
-  for (auto &i: _inputs) std::cout << " " << i->data;
+  for (uint i=0; i<INPUTS; i++) std::cout << " " << data[i];
   std::cout << "\n";
 #endif
 }
 
 void CPPN::operator() (const Point &src, const Point &dst,
                        Outputs &outputs) const {
-  assert(outputs.size() == _outputs.size());
+  operator() (src, dst, outputs, _context);
+}
+
+void CPPN::operator() (const Point &src, const Point &dst, Outputs &outputs,
+                       const OutputSubset &oset) const {
+  operator() (src, dst, outputs, oset, _context);
+}
+
+float CPPN::operator() (const Point &src, const Point &dst,
+                        genotype::cppn::Output o) const {
+  return operator() (src, dst, o, _context);
+}
 
-  pre_evaluation(src, dst);
-  for (uint i=0; i<outputs.size(); i++) outputs[i] = _outputs[i]->value();
+void CPPN::operator() (const Point &src, const Point &dst,
+                       Outputs &outputs, Context &context) const {
+  const Program &p = _programs.back();
+  pre_evaluation(p, src, dst, context);
+  evaluate(p, context);
+  for (uint i=0; i<OUTPUTS; i++) outputs[i] = context.data[i+INPUTS];
 
 #ifdef DEBUG
   using utils::operator<<;
@@ -266,12 +607,16 @@ void CPPN::operator() (const Point &src, const Point &dst,
 }
 
 void CPPN::operator() (const Point &src, const Point &dst, Outputs &outputs,
-                       const OutputSubset &oset) const {
-  assert(outputs.size() == _outputs.size());
-  assert(oset.size() <= _outputs.size());
+                       const OutputSubset &oset, Context &context) const {
+  assert(oset.size() <= OUTPUTS);
+
+  uint mask = 0;
+  for (auto o: oset) mask |= 1u << uint(o);
 
-  pre_evaluation(src, dst);
-  for (auto o: oset) outputs[uint(o)] = _outputs[uint(o)]->value();
+  const Program &p = _programs[mask];
+  pre_evaluation(p, src, dst, context);
+  evaluate(p, context);
+  for (auto o: oset) outputs[uint(o)] = context.data[uint(o)+INPUTS];
 
 #ifdef DEBUG
   using utils::operator<<;
@@ -280,9 +625,690 @@ void CPPN::operator() (const Point &src, const Point &dst, Outputs &outputs,
 }
 
 float CPPN::operator() (const Point &src, const Point &dst,
-                        genotype::cppn::Output o) const {
-  pre_evaluation(src, dst);
-  return _outputs[uint(o)]->value();
+                        genotype::cppn::Output o, Context &context) const {
+  const Program &p = _programs[1u << uint(o)];
+  pre_evaluation(p, src, dst, context);
+  evaluate(p, context);
+  return context.data[uint(o)+INPUTS];
+}
+
+// =============================================================================
+
+uint CPPN::pre_evaluation (const Program &p,
+                           const Points &srcs, const Points &dsts,
+                           Context &context) const {
+  static constexpr auto N = DIMENSIONS;
+  assert(srcs.size() == dsts.size() || srcs.size() == 1 || dsts.size() == 1);
+  const uint n = (srcs.empty() || dsts.empty()) ?
+                   0 : std::max(srcs.size(), dsts.size());
+  const auto point = [n] (const Points &points, uint i) -> const Point& {
+    return points.size() == n ? points[i] : points.front();
+  };
+
+  context.batchData.resize(_bufferSize * n);
+  context.batchSum.resize(n);
+
+  const auto used = [&p] (uint i) { return p.inputs & (1u << i); };
+  float *data = context.batchData.data();
+  for (uint d=0; d<N; d++)
+    if (used(d))
+      for (uint i=0; i<n; i++)  data[d*n+i] = point(srcs, i).get(d);
+  for (uint d=0; d<N; d++)
+    if (used(d+N))
+      for (uint i=0; i<n; i++)  data[(d+N)*n+i] = point(dsts, i).get(d);
+
+#if ESHN_WITH_DISTANCE
+  static const float norm = 2*std::sqrt(2);
+  if (used(2*N))
+    for (uint i=0; i<n; i++)
+      data[2*N*n+i] = (point(srcs, i) - point(dsts, i)).length() / norm;
+#endif
+
+  std::fill_n(data + (INPUTS-1)*n, n, 1.f);
+
+  return n;
+}
+
+void CPPN::evaluate (const Program &p, uint n, Context &context,
+                     bool reduced) {
+  float *data = context.batchData.data();
+  for (const Constant &c: p.constants)
+    std::fill_n(data + c.index * n, n, c.value);
+  for (const Node &node: p.nodes) evaluate(p, node, n, context, reduced);
+}
+
+void CPPN::evaluate (const Program &p, const Node &node, uint n,
+                     Context &context, bool reduced) {
+  float *data = context.batchData.data();
+  float * __restrict sum = context.batchSum.data();
+  float *v = data + node.index * n;
+  if (node.reset)
+    std::fill_n(sum, n, node.init);
+  else
+    std::copy_n(v, n, sum);
+
+  for (uint i=node.lbegin; i<node.lend; i++) {
+    const float w = p.links[i].weight;
+    const float * __restrict src = data + p.links[i].src * n;
+    for (uint j=0; j<n; j++)  sum[j] += w * src[j];
+  }
+
+  if (node.apply)
+    (reduced ? node.reduced : node.kernel)(sum, v, n);
+  else
+    std::copy_n(sum, n, v);
+}
+
+void CPPN::post_evaluation (uint o, uint n, const Context &context,
+                            std::vector<float> &outputs) {
+  const float *row = context.batchData.data() + (o+INPUTS) * n;
+  outputs.assign(row, row + n);
+}
+
+void CPPN::operator() (const Points &srcs, const Points &dsts,
+                       BatchOutputs &outputs) const {
+  operator() (srcs, dsts, outputs, _context);
+}
+
+void CPPN::operator() (const Points &srcs, const Points &dsts,
+                       BatchOutputs &outputs, const OutputSubset &oset) const {
+  operator() (srcs, dsts, outputs, oset, _context);
+}
+
+void CPPN::operator() (const Points &srcs, const Points &dsts,
+                       std::vector<float> &outputs,
+                       genotype::cppn::Output o) const {
+  operator() (srcs, dsts, outputs, o, _context);
+}
+
+void CPPN::operator() (const Points &srcs, const Points &dsts,
+                       BatchOutputs &outputs, Context &context) const {
+  const Program &p = _programs.back();
+  uint n = pre_evaluation(p, srcs, dsts, context);
+  evaluate(p, n, context);
+  for (uint o=0; o<OUTPUTS; o++) post_evaluation(o, n, context, outputs[o]);
+}
+
+void CPPN::operator() (const Points &srcs, const Points &dsts,
+                       BatchOutputs &outputs, const OutputSubset &oset,
+                       Context &context) const {
+  uint mask = 0;
+  for (auto o: oset) mask |= 1u << uint(o);
+
+  const Program &p = _programs[mask];
+  uint n = pre_evaluation(p, srcs, dsts, context);
+  evaluate(p, n, context);
+  for (auto o: oset) post_evaluation(uint(o), n, context, outputs[uint(o)]);
+}
+
+void CPPN::operator() (const Points &srcs, const Points &dsts,
+                       std::vector<float> &outputs, genotype::cppn::Output o,
+                       Context &context) const {
+  const Program &p = _programs[1u << uint(o)];
+  uint n = pre_evaluation(p, srcs, dsts, context);
+  evaluate(p, n, context);
+  post_evaluation(uint(o), n, context, outputs);
+}
+
+void CPPN::reducedPrecision (const Points &srcs, const Points &dsts,
+                             std::vector<float> &outputs,
+                             genotype::cppn::Output o,
+                             Context &context) const {
+  const Program &p = _programs[1u << uint(o)];
+  uint n = pre_evaluation(p, srcs, dsts, context);
+  evaluate(p, n, context, true);
+  post_evaluation(uint(o), n, context, outputs);
+}
+
+// =============================================================================
+
+void CPPN::evaluate (const Program &p, const Point &fixed, const Grid &grid,
+                     bool source, uint mask, BatchOutputs &outputs,
+                     Context &context) const {
+  static constexpr auto N = DIMENSIONS;
+  const uint R = grid.rows.size(), C = grid.columns.size(), n = R * C;
+  if (n == 0) {
+    for (uint o=0; o<OUTPUTS; o++)  if (mask & (1u << o))  outputs[o].clear();
+    return;
+  }
+
+  // Shape of a node's values: which of the grid's rows and columns they
+  // depend on. Values of shape k are stored row by row in the first
+  // rows(k) * cols(k) elements of the node's batchData row
+  enum Shape : uint { CONST = 0, ROW = 1, COL = 2, BOTH = 3 };
+  const auto rows = [R] (uint k) { return (k & ROW) ? R : 1; };
+  const auto cols = [C] (uint k) { return (k & COL) ? C : 1; };
+
+  std::vector<uint> shapes (_bufferSize, CONST);
+  const uint offset = source ? 0 : N;
+  shapes[offset] = COL;
+  for (uint i=1; i<N; i++)  shapes[offset+i] = ROW;
+#if ESHN_WITH_DISTANCE
+  shapes[2*N] = BOTH;
+#endif
+
+  // A node depends on whatever its sources depend on (recurrent links may
+  // need a few passes)
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (const Node &node: p.nodes) {
+      uint k = shapes[node.index];
+      for (uint i=node.lbegin; i<node.lend; i++)
+        k |= shapes[p.links[i].src];
+      changed |= (k != shapes[node.index]);
+      shapes[node.index] = k;
+    }
+  }
+
+  context.batchData.resize(_bufferSize * n);
+  context.batchSum.resize(n);
+  float *data = context.batchData.data();
+  float * __restrict sum = context.batchSum.data();
+
+  const auto used = [&p] (uint i) { return p.inputs & (1u << i); };
+  for (uint d=0; d<N; d++) {
+    float *f = data + (d + N - offset) * n, *g = data + (d + offset) * n;
+    if (used(d + N - offset)) *f = fixed.get(d);
+    if (!used(d + offset))  continue;
+    if (d == 0)
+      for (uint c=0; c<C; c++)  g[c] = grid.point(0, c).get(0);
+    else
+      for (uint r=0; r<R; r++)  g[r] = grid.rows[r].get(d);
+  }
+
+#if ESHN_WITH_DISTANCE
+  static const float norm = 2*std::sqrt(2);
+  if (used(2*N))
+    for (uint r=0; r<R; r++) {
+      for (uint c=0; c<C; c++) {
+        const Point q = grid.point(r, c);
+        data[2*N*n+r*C+c] = (source ? fixed - q : q - fixed).length() / norm;
+      }
+    }
+#endif
+
+  data[(INPUTS-1)*n] = 1;
+
+  for (const Constant &c: p.constants)  data[c.index * n] = c.value;
+
+  // Broadcasts sum from shape from to shape to (a superset), backwards so
+  // that no value is overwritten before being read
+  const auto expand = [&] (uint from, uint to) {
+    if (from == to) return;
+    for (uint r=rows(to); r-- > 0; )
+      for (uint c=cols(to); c-- > 0; )
+        sum[r*cols(to)+c] = sum[((from & ROW) ? r : 0) * cols(from)
+                                + ((from & COL) ? c : 0)];
+  };
+
+  for (const Node &node: p.nodes) {
+    float *v = data + node.index * n;
+    uint k = shapes[node.index];
+    uint shape = k;
+    if (node.reset) {
+      sum[0] = node.init;
+      shape = CONST;
+    } else
+      std::copy_n(v, rows(k) * cols(k), sum);
+
+    // Terms are added in the same order as a pointwise evaluation, the sum
+    // being widened only when it starts to vary along rows (columns)
+    for (uint i=node.lbegin; i<node.lend; i++) {
+      const float w = p.links[i].weight;
+      const uint src = p.links[i].src, s = shapes[src];
+      expand(shape, shape | s);
+      shape |= s;
+
+      const float *x = data + src * n;
+      for (uint r=0; r<rows(shape); r++) {
+        const float * __restrict xr = x + ((s & ROW) ? r * cols(s) : 0);
+        float * __restrict sr = sum + r * cols(shape);
+        if (s & COL)
+          for (uint c=0; c<cols(shape); c++)  sr[c] += w * xr[c];
+        else {
+          const float t = w * xr[0];
+          for (uint c=0; c<cols(shape); c++)  sr[c] += t;
+        }
+      }
+    }
+
+    expand(shape, k);
+    if (node.apply)
+      node.kernel(sum, v, rows(k) * cols(k));
+    else
+      std::copy_n(sum, rows(k) * cols(k), v);
+  }
+
+  for (uint o=0; o<OUTPUTS; o++) {
+    if (!(mask & (1u << o)))  continue;
+    const uint k = shapes[o+INPUTS];
+    const float *v = data + (o+INPUTS) * n;
+    auto &out = outputs[o];
+    out.resize(n);
+    for (uint r=0; r<R; r++)
+      for (uint c=0; c<C; c++)
+        out[r*C+c] = v[((k & ROW) ? r : 0) * cols(k) + ((k & COL) ? c : 0)];
+  }
+}
+
+void CPPN::operator() (const Point &src, const Grid &dsts,
+                       BatchOutputs &outputs) const {
+  operator() (src, dsts, outputs, _context);
+}
+
+void CPPN::operator() (const Grid &srcs, const Point &dst,
+                       BatchOutputs &outputs) const {
+  operator() (srcs, dst, outputs, _context);
+}
+
+void CPPN::operator() (const Point &src, const Grid &dsts,
+                       std::vector<float> &outputs,
+                       genotype::cppn::Output o) const {
+  operator() (src, dsts, outputs, o, _context);
+}
+
+void CPPN::operator() (const Grid &srcs, const Point &dst,
+                       std::vector<float> &outputs,
+                       genotype::cppn::Output o) const {
+  operator() (srcs, dst, outputs, o, _context);
+}
+
+void CPPN::operator() (const Point &src, const Grid &dsts,
+                       BatchOutputs &outputs, Context &context) const {
+  evaluate(_programs.back(), src, dsts, false, _programs.size()-1, outputs,
+           context);
+}
+
+void CPPN::operator() (const Grid &srcs, const Point &dst,
+                       BatchOutputs &outputs, Context &context) const {
+  evaluate(_programs.back(), dst, srcs, true, _programs.size()-1, outputs,
+           context);
+}
+
+void CPPN::operator() (const Point &src, const Grid &dsts,
+                       std::vector<float> &outputs, genotype::cppn::Output o,
+                       Context &context) const {
+  BatchOutputs boutputs;
+  std::swap(boutputs[uint(o)], outputs);
+  evaluate(_programs[1u << uint(o)], src, dsts, false, 1u << uint(o),
+           boutputs, context);
+  std::swap(boutputs[uint(o)], outputs);
+}
+
+void CPPN::operator() (const Grid &srcs, const Point &dst,
+                       std::vector<float> &outputs, genotype::cppn::Output o,
+                       Context &context) const {
+  BatchOutputs boutputs;
+  std::swap(boutputs[uint(o)], outputs);
+  evaluate(_programs[1u << uint(o)], dst, srcs, true, 1u << uint(o),
+           boutputs, context);
+  std::swap(boutputs[uint(o)], outputs);
+}
+
+CPPN::Range CPPN::operator() (const Box &srcs, const Box &dsts,
+                              genotype::cppn::Output o) const {
+  return operator() (srcs, dsts, o, _context);
+}
+
+CPPN::Range CPPN::operator() (const Box &srcs, const Box &dsts,
+                              genotype::cppn::Output o,
+                              Context &context) const {
+  static constexpr auto N = DIMENSIONS;
+  const Program &p = _programs[1u << uint(o)];
+
+  auto &data = context.intervals;
+  data.resize(_bufferSize, {NAN, NAN});
+  for (uint i=0; i<N; i++)  data[i] = { srcs.min.get(i), srcs.max.get(i) };
+  for (uint i=0; i<N; i++)  data[i+N] = { dsts.min.get(i), dsts.max.get(i) };
+
+#if ESHN_WITH_DISTANCE
+  if (p.inputs & (1u << 2*N)) {
+    // Differences are rounded to the points' fixed-point precision: widen by
+    // one step to cover it
+    Range l2 { 0, 0 };
+    for (uint i=0; i<N; i++) {
+      float a = data[i].min - data[i+N].max - Point::EPSILON,
+            b = data[i].max - data[i+N].min + Point::EPSILON;
+      l2.min += (a <= 0 && 0 <= b) ? 0 : std::min(a*a, b*b);
+      l2.max += std::max(a*a, b*b);
+    }
+    static const float norm = 2*std::sqrt(2);
+    data[2*N] = { std::sqrt(l2.min) / norm, std::sqrt(l2.max) / norm };
+  }
+#endif
+
+  data[INPUTS-1] = { 1, 1 };
+
+  for (const Constant &c: p.constants)  data[c.index] = { c.value, c.value };
+
+  for (const Node &n: p.nodes) {
+    Range v = n.reset ? Range{ n.init, n.init } : data[n.index];
+    for (uint i=n.lbegin; i<n.lend; i++) {
+      const float w = p.links[i].weight;
+      const Range &x = data[p.links[i].src];
+      if (w >= 0) {
+        v.min += w * x.min;
+        v.max += w * x.max;
+      } else {
+        v.min += w * x.max;
+        v.max += w * x.min;
+      }
+    }
+    data[n.index] = n.apply ? n.bounds(v) : v;
+  }
+
+  return data[uint(o)+INPUTS];
+}
+
+// =============================================================================
+
+void CPPN::record (const Program &p, const Points &srcs, const Points &dsts,
+                   Trace &trace, Context &context) const {
+  assert(_ids.size() == _bufferSize);
+  trace.srcs = srcs;
+  trace.dsts = dsts;
+  trace.reusable = _acyclic;
+  trace.nodes.clear();
+  if (_acyclic) {
+    for (const Node &node: p.nodes) {
+      Trace::Node &t = trace.nodes[_ids[node.index]];
+      t.func = node.func;
+      t.row = node.index;
+      for (uint i=node.lbegin; i<node.lend; i++)
+        t.links.push_back({_ids[p.links[i].src], p.links[i].weight});
+    }
+  }
+  std::swap(trace.values, context.batchData);
+}
+
+void CPPN::trace (const Points &srcs, const Points &dsts,
+                  BatchOutputs &outputs, Trace &trace) const {
+  this->trace(srcs, dsts, outputs, trace, _context);
+}
+
+void CPPN::trace (const Points &srcs, const Points &dsts,
+                  BatchOutputs &outputs, Trace &trace,
+                  Context &context) const {
+  if (_ids.size() != _bufferSize)
+    utils::Thrower("Specialized CPPNs cannot be traced");
+  const Program &p = _programs.back();
+  uint n = pre_evaluation(p, srcs, dsts, context);
+  evaluate(p, n, context);
+  for (uint o=0; o<OUTPUTS; o++) post_evaluation(o, n, context, outputs[o]);
+  record(p, srcs, dsts, trace, context);
+}
+
+uint CPPN::retrace (const Trace &previous, BatchOutputs &outputs,
+                    Trace &trace) const {
+  return retrace(previous, outputs, trace, _context);
+}
+
+uint CPPN::retrace (const Trace &previous, BatchOutputs &outputs,
+                    Trace &trace, Context &context) const {
+  if (_ids.size() != _bufferSize)
+    utils::Thrower("Specialized CPPNs cannot be retraced");
+  const Program &p = _programs.back();
+  uint n = pre_evaluation(p, previous.srcs, previous.dsts, context);
+  uint evaluated = 0;
+
+  if (!_acyclic || !previous.reusable) {
+    evaluate(p, n, context);
+    for (const Node &node: p.nodes) evaluated += node.apply;
+
+  } else {
+    // A node is unchanged if it computes the same function of the same links
+    // to unchanged nodes, whose values are then (by induction) identical.
+    // Chunks of acyclic programs only read completed nodes: a first pass in
+    // program order settles every node before any evaluation
+    std::vector<bool> same (_bufferSize, false);
+    std::fill_n(same.begin(), INPUTS, true);
+    std::vector<const Trace::Node*> match (_bufferSize, nullptr);
+    std::vector<uint> read (_bufferSize, 0);
+    for (const Node &node: p.nodes) {
+      const uint i = node.index;
+      if (node.reset) {
+        auto it = previous.nodes.find(_ids[i]);
+        same[i] = (it != previous.nodes.end())
+               && (it->second.func == node.func);
+        if (same[i])  match[i] = &it->second;
+      }
+
+      for (uint l=node.lbegin; same[i] && l<node.lend; l++) {
+        const Link &link = p.links[l];
+        const auto &links = match[i]->links;
+        same[i] = read[i] < links.size() && same[link.src]
+               && links[read[i]].first == _ids[link.src]
+               && links[read[i]].second == link.weight;
+        read[i]++;
+      }
+
+      if (node.apply && same[i])
+        same[i] = (read[i] == match[i]->links.size());
+    }
+
+    float *data = context.batchData.data();
+    for (const Node &node: p.nodes) {
+      if (!same[node.index]) {
+        evaluate(p, node, n, context);
+        evaluated += node.apply;
+      } else if (node.apply)
+        std::copy_n(previous.values.data() + match[node.index]->row * n, n,
+                    data + node.index * n);
+    }
+  }
+
+  for (uint o=0; o<OUTPUTS; o++) post_evaluation(o, n, context, outputs[o]);
+  record(p, previous.srcs, previous.dsts, trace, context);
+  return evaluated;
+}
+
+// =============================================================================
+
+void CPPN::derivatives (const Point &src, const Point &dst, bool source,
+                        Outputs &outputs,
+                        OutputsDerivatives &derivatives) const {
+  this->derivatives(src, dst, source, outputs, derivatives, _context);
+}
+
+void CPPN::derivatives (const Point &src, const Point &dst, bool source,
+                        Outputs &outputs, OutputsDerivatives &derivatives,
+                        Context &context) const {
+  static constexpr auto N = DIMENSIONS;
+  const Program &p = _programs.back();
+  pre_evaluation(p, src, dst, context);
+  float *data = context.data.data();
+
+  // Seed the inputs' derivatives (null for the bias and constants)
+  auto &tangents = context.tangents;
+  tangents.assign(_bufferSize * N, {0, 0});
+  const uint offset = source ? 0 : N;
+  for (uint i=0; i<N; i++)  tangents[(offset+i)*N+i] = {1, 0};
+
+#if ESHN_WITH_DISTANCE
+  if (p.inputs & (1u << 2*N)) {
+    static const float norm = 2*std::sqrt(2);
+    const Point d = source ? src - dst : dst - src;
+    const float l = d.length();
+    if (l > 0)
+      for (uint i=0; i<N; i++)
+        tangents[2*N*N+i] = { d.get(i) / (l * norm),
+                              (l*l - d.get(i)*d.get(i)) / (l*l*l * norm) };
+  }
+#endif
+
+  for (const Constant &c: p.constants)  data[c.index] = c.value;
+  for (const Node &n: p.nodes) {
+    auto *t = tangents.data() + n.index * N;
+    float v = n.reset ? n.init : data[n.index];
+    Derivatives d {};
+    if (!n.reset) std::copy_n(t, N, d.begin());
+
+    for (uint i=n.lbegin; i<n.lend; i++) {
+      const Link &l = p.links[i];
+      v += l.weight * data[l.src];
+      const auto *ts = tangents.data() + l.src * N;
+      for (uint j=0; j<N; j++) {
+        d[j].first += l.weight * ts[j].first;
+        d[j].second += l.weight * ts[j].second;
+      }
+    }
+
+    if (n.apply) {
+      // (f o g)' = f'(g) g' and (f o g)'' = f''(g) g'^2 + f'(g) g''
+      const activations::Derivatives f = n.derivatives(v);
+      for (auto &dj: d)
+        dj = { f.first * dj.first,
+               f.second * dj.first * dj.first + f.first * dj.second };
+      data[n.index] = n.func(v);
+    } else
+      data[n.index] = v;
+    std::copy_n(d.begin(), N, t);
+  }
+
+  for (uint o=0; o<OUTPUTS; o++) {
+    outputs[o] = data[o+INPUTS];
+    std::copy_n(tangents.data() + (o+INPUTS) * N, N, derivatives[o].begin());
+  }
+}
+
+// =============================================================================
+
+QueryCache::QueryCache (const CPPN &cppn, bool enabled)
+  : _cppn(cppn), _enabled(enabled && cppn.acyclic()),
+    _source(false), _specialized(false), _hits(0), _misses(0) {}
+
+void QueryCache::specialize (const Point &p, bool source) {
+  if (_specialized && _fixed == p && _source == source)  return;
+  _residual = _cppn.specialize(p, source);
+  _fixed = p;
+  _source = source;
+  _specialized = true;
+}
+
+const CPPN& QueryCache::cppn (const CPPN::Points &srcs,
+                              const CPPN::Points &dsts) const {
+  if (!_specialized)  return _cppn;
+  for (const Point &p: _source ? srcs : dsts)
+    if (p != _fixed)  return _cppn;
+  return _residual;
+}
+
+const CPPN& QueryCache::cppn (const Point &src, const Point &dst) const {
+  if (_specialized && (_source ? src : dst) == _fixed)  return _residual;
+  return _cppn;
+}
+
+float QueryCache::operator() (const Point &src, const Point &dst,
+                              genotype::cppn::Output o) {
+  if (!_enabled) {
+    _misses++;
+    return cppn(src, dst)(src, dst, o, _context);
+  }
+
+  auto r = _entries.try_emplace({src, dst});
+  if (r.second) {
+    _misses++;
+    cppn(src, dst)(src, dst, r.first->second, _context);
+  } else
+    _hits++;
+  return r.first->second[uint(o)];
+}
+
+void QueryCache::reducedPrecision (const CPPN::Points &srcs,
+                                   const CPPN::Points &dsts,
+                                   std::vector<float> &outputs,
+                                   genotype::cppn::Output o) {
+  cppn(srcs, dsts).reducedPrecision(srcs, dsts, outputs, o, _context);
+  _misses += outputs.size();
+}
+
+float QueryCache::derivatives (const Point &src, const Point &dst,
+                               genotype::cppn::Output o, bool source,
+                               CPPN::Derivatives &derivatives) {
+  // The residual CPPN has no derivatives with respect to its fixed point
+  const CPPN &c = (source == _source) ? _cppn : cppn(src, dst);
+  CPPN::Outputs outputs;
+  CPPN::OutputsDerivatives all;
+  c.derivatives(src, dst, source, outputs, all, _context);
+  _misses++;
+
+  if (_enabled) _entries.try_emplace({src, dst}, outputs);
+  derivatives = all[uint(o)];
+  return outputs[uint(o)];
+}
+
+CPPN::Range QueryCache::operator() (const CPPN::Box &srcs,
+                                    const CPPN::Box &dsts,
+                                    genotype::cppn::Output o) {
+  const CPPN::Box &fixed = _source ? srcs : dsts;
+  if (fixed.min == fixed.max)
+    return cppn(srcs.min, dsts.min)(srcs, dsts, o, _context);
+  else
+    return _cppn(srcs, dsts, o, _context);
+}
+
+uint QueryCache::batch (const CPPN::Points &srcs, const CPPN::Points &dsts) {
+  const uint n = (srcs.empty() || dsts.empty()) ?
+                   0 : std::max(srcs.size(), dsts.size());
+
+  // Register unknown pairs (once) and evaluate them in a single batch
+  _msrcs.clear();
+  _mdsts.clear();
+  _mentries.clear();
+  for (uint i=0; i<n; i++) {
+    const Point &src = point(srcs, n, i), &dst = point(dsts, n, i);
+    auto r = _entries.try_emplace({src, dst});
+    if (r.second) {
+      _msrcs.push_back(src);
+      _mdsts.push_back(dst);
+      _mentries.push_back(&r.first->second);
+    }
+  }
+
+  if (!_mentries.empty()) {
+    cppn(_msrcs, _mdsts)(_msrcs, _mdsts, _moutputs, _context);
+    for (uint i=0; i<_mentries.size(); i++)
+      for (uint j=0; j<CPPN::OUTPUTS; j++)
+        (*_mentries[i])[j] = _moutputs[j][i];
+  }
+
+  _misses += _mentries.size();
+  _hits += n - _mentries.size();
+  return n;
+}
+
+void QueryCache::operator() (const CPPN::Points &srcs,
+                             const CPPN::Points &dsts,
+                             std::vector<float> &outputs,
+                             genotype::cppn::Output o) {
+  if (!_enabled) {
+    cppn(srcs, dsts)(srcs, dsts, outputs, o, _context);
+    _misses += outputs.size();
+    return;
+  }
+
+  const uint n = batch(srcs, dsts);
+  outputs.resize(n);
+  for (uint i=0; i<n; i++)
+    outputs[i] = _entries.at({point(srcs, n, i), point(dsts, n, i)})[uint(o)];
+}
+
+void QueryCache::operator() (const CPPN::Points &srcs,
+                             const CPPN::Points &dsts,
+                             CPPN::BatchOutputs &outputs,
+                             const CPPN::OutputSubset &oset) {
+  if (!_enabled) {
+    cppn(srcs, dsts)(srcs, dsts, outputs, oset, _context);
+    _misses += outputs[uint(*oset.begin())].size();
+    return;
+  }
+
+  const uint n = batch(srcs, dsts);
+  for (auto o: oset)  outputs[uint(o)].resize(n);
+  for (uint i=0; i<n; i++) {
+    const auto &e = _entries.at({point(srcs, n, i), point(dsts, n, i)});
+    for (auto o: oset)  outputs[uint(o)][i] = e[uint(o)];
+  }
 }
 
 } // end of namespace phenotype
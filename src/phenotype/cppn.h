@@ -1,7 +1,11 @@
 #ifndef KGD_CPPN_PHENOTYPE_H
 #define KGD_CPPN_PHENOTYPE_H
 
+#include <unordered_map>
+
 #include "../genotype/es-hyperneat.h"
+#include "activations.h"
+#include "native.h"
 #include "point.hpp"
 
 namespace phenotype {
@@ -9,54 +13,179 @@ namespace phenotype {
 class CPPN {
 public:
   static constexpr auto DIMENSIONS = Point::DIMENSIONS;
+  static constexpr auto INPUTS = genotype::ES_HyperNEAT::CPPN::INPUTS;
+  static constexpr auto OUTPUTS = genotype::ES_HyperNEAT::CPPN::OUTPUTS;
 
   using FuncID = genotype::ES_HyperNEAT::CPPN::Node::FuncID;
   using Function = float (*) (float);
-  static const std::map<FuncID, CPPN::Function> functions;
+  template <typename T>
+  using FunctionArray = genotype::cppn::FunctionArray<T>;
+
+  static const FunctionArray<Function> functions;
   static const std::map<CPPN::Function, FuncID> functionToName;
 
-  struct Range { float min, max; };
-  static const std::map<FuncID, Range> functionRanges;
+  using Range = activations::Range;
+  static const FunctionArray<Range> functionRanges;
 
-private:
-  struct Node_base {
-    float data;
+  /// Scratch buffers for the evaluation of a CPPN
+  /// Queries taking a context never modify the CPPN itself: an immutable
+  /// instance can thus be shared by any number of threads with one context
+  /// each. Buffers are (re)sized on demand and can be reused across CPPNs.
+  struct Context {
+    /// Layout: inputs, outputs, hidden (evaluated ones, in genotype order)
+    std::vector<float> data;
+
+    /// Same layout as data with one row of batch-size values per node
+    std::vector<float> batchData;
+
+    /// Accumulator for one row of batchData
+    std::vector<float> batchSum;
+
+    /// Same layout as data for interval evaluations
+    std::vector<Range> intervals;
+
+    /// Partial derivatives (DIMENSIONS per value of data) for derivative
+    /// queries
+    std::vector<activations::Derivatives> tangents;
+  };
+
+  struct Size {
+    uint nodes;   ///< Hidden nodes
+    uint links;
+  };
 
-    virtual float value (void) = 0;
+  struct Simplification {
+    Size before, after;
   };
-  using Node_ptr = std::shared_ptr<Node_base>;
-  using Node_wptr = std::weak_ptr<Node_base>;
 
-  struct INode : public Node_base {
-    float value (void) override;
+private:
+  /// A contiguous chunk of the (flattened) evaluation of a node
+  /// The last one of each evaluated node applies its function. Recursions
+  /// (into sources not evaluated yet) split the evaluation of the nodes they
+  /// traverse so that partial sums are visible to recurrent connections in
+  /// the same order as in a recursive evaluation
+  struct Node {
+    uint index;         ///< Position in the evaluation buffer
+    FuncID fid;         ///< Of func (tabulated functions have no name)
+    Function func;
+    activations::Kernel kernel; ///< Batch version of func
+    activations::Kernel reduced;  ///< Cheaper (approximate) kernel
+    activations::IntervalFunction bounds; ///< Interval version of func
+    activations::DerivativesFunction derivatives; ///< Of func
+    uint lbegin, lend;  ///< Range of incoming links in Program::links
+    bool reset;         ///< Whether to start from init or from the buffer
+    float init;         ///< Starting value (folded constant links, if any)
+    bool apply;         ///< Whether this chunk completes the node
   };
 
   struct Link {
     float weight;
-    Node_wptr node;
+    uint src;           ///< Position in the evaluation buffer
   };
 
-  struct FNode : public Node_base {
-    float value (void) override;
-
-    const Function func;
+  struct Constant {
+    uint index;         ///< Position in the evaluation buffer
+    float value;
+  };
 
+  /// Topologically ordered nodes (and their links) needed for a given set of
+  /// outputs
+  struct Program {
+    std::vector<Node> nodes;
     std::vector<Link> links;
 
-    FNode (Function f) : func(f) {}
+    /// Values folded by specialization, written before evaluation
+    std::vector<Constant> constants;
+
+    /// Bitmask of the inputs read by the links (others are not computed)
+    uint inputs = 0;
+
+    /// Straight-line version of the scalar evaluation (see CPPN::compile)
+    using Native = void (*) (float *data, const Function *functions);
+    Native native = nullptr;
+
+    /// Activation functions called by native, in order of first appearance
+    std::vector<Function> functions;
+
+    void updateInputs (void);
+
+    /// C++ source of an extern "C" function name with the Native signature
+    std::string source (const std::string &name, uint bufferSize,
+                        std::vector<Function> &functions) const;
   };
 
-  std::vector<Node_ptr> _inputs, _hidden, _outputs;
+  /// One program per non-empty output subset (indexed by bitmask), i.e. the
+  /// dependency cone of these outputs
+  std::array<Program, 1u << OUTPUTS> _programs;
+
+  /// Number of values in the evaluation buffer (inputs, outputs, hidden and
+  /// constants of specialized CPPNs)
+  uint _bufferSize;
+
+  /// Whether outputs are independent from the subset being evaluated
+  bool _acyclic;
+
+  /// Genotype node of each non-constant value of the evaluation buffer
+  std::vector<genotype::ES_HyperNEAT::CPPN::Node::ID> _ids;
+
+  Simplification _simplification;
+
+  /// Graph from which the programs are flattened
+  struct GNode;
+
+  /// Removes structure that cannot change the outputs: links with null
+  /// weights, nodes unreachable from the outputs and, for acyclic graphs,
+  /// id nodes forwarding +/-x and nodes computing the same sum as another.
+  /// Outputs are bitwise identical. Hidden nodes are renumbered contiguously
+  static void simplify (std::vector<GNode> &graph);
+
+  /// Used by the context-less queries (which are thus not reentrant)
+  mutable Context _context;
+
+  /// Shared object holding the native programs, if any
+  native::Library _library;
 
 public:
   CPPN(void);
 
-  static CPPN fromGenotype (const genotype::ES_HyperNEAT &es_hyperneat);
+  /// Phenotype of the genotype's CPPN, simplified unless requested otherwise
+  /// (e.g. as a reference, see simplify)
+  static CPPN fromGenotype (const genotype::ES_HyperNEAT &es_hyperneat,
+                            bool simplified = true);
+
+  auto inputSize (void) const { return INPUTS;  }
+  auto outputSize (void) const {  return OUTPUTS;  }
 
-  auto inputSize (void) const { return _inputs.size();  }
-  auto outputSize (void) const {  return _outputs.size();  }
+  /// Whether no recurrent connection is reachable from the outputs.
+  /// Only then do all queries of a pair return the same values
+  bool acyclic (void) const {   return _acyclic;  }
 
-  using Outputs = std::array<float, genotype::ES_HyperNEAT::CPPN::OUTPUTS>;
+  /// Size of the genotype and of the graph actually evaluated (see simplify)
+  const Simplification& simplification (void) const {
+    return _simplification;
+  }
+
+  /// Residual CPPN for queries whose source (or destination) is always p
+  /// Every computation depending only on p (and the bias) is folded once and
+  /// for all. Partial sums are only folded up to the first non-constant link
+  /// so that outputs are bitwise identical to those of the full CPPN.
+  /// Queries on the residual must use p for the fixed side (which is ignored)
+  CPPN specialize (const Point &p, bool source) const;
+
+  /// Replaces the interpreted scalar evaluation by native code
+  /// Generates straight-line C++ (weights inlined) for every program and
+  /// loads it from a shared object built by the local compiler (cached on
+  /// disk, see native.h). Worth it only for CPPNs queried extensively (e.g.
+  /// champions in final evaluations or replays). Outputs are unchanged.
+  /// Returns false (and keeps the interpreter) if compilation failed.
+  /// Batch and interval queries, as well as specialized CPPNs, are still
+  /// interpreted.
+  bool compile (void);
+
+  /// Whether scalar queries run native code
+  bool compiled (void) const {  return bool(_library); }
+
+  using Outputs = std::array<float, OUTPUTS>;
 
   void operator() (const Point &src, const Point &dst, Outputs &outputs) const;
 
@@ -67,8 +196,311 @@ public:
   void operator() (const Point &src, const Point &dst, Outputs &outputs,
                    const OutputSubset &oset) const;
 
+  /// \name Reentrant single queries
+  /// Same as above using the provided scratch buffers
+  /// @{
+  void operator() (const Point &src, const Point &dst, Outputs &outputs,
+                   Context &context) const;
+
+  float operator() (const Point &src, const Point &dst,
+                    genotype::cppn::Output o, Context &context) const;
+
+  void operator() (const Point &src, const Point &dst, Outputs &outputs,
+                   const OutputSubset &oset, Context &context) const;
+  /// @}
+
+  /// \name Batch queries
+  /// Structure-of-arrays evaluation of srcs[i] -> dsts[i] for every i. Either
+  /// span may hold a single point which is then paired with all the others.
+  /// Each requested output gets one value per query, bitwise identical to the
+  /// corresponding single-pair query.
+  /// @{
+  using Points = std::vector<Point>;
+  using BatchOutputs = std::array<std::vector<float>, OUTPUTS>;
+
+  void operator() (const Points &srcs, const Points &dsts,
+                   BatchOutputs &outputs) const;
+
+  void operator() (const Points &srcs, const Points &dsts,
+                   std::vector<float> &outputs, genotype::cppn::Output o) const;
+
+  void operator() (const Points &srcs, const Points &dsts,
+                   BatchOutputs &outputs, const OutputSubset &oset) const;
+
+  void operator() (const Points &srcs, const Points &dsts,
+                   BatchOutputs &outputs, Context &context) const;
+
+  void operator() (const Points &srcs, const Points &dsts,
+                   std::vector<float> &outputs, genotype::cppn::Output o,
+                   Context &context) const;
+
+  void operator() (const Points &srcs, const Points &dsts,
+                   BatchOutputs &outputs, const OutputSubset &oset,
+                   Context &context) const;
+
+  /// Same as above with reduced-precision activation functions (see
+  /// activations::reducedKernel): for values that only steer the search
+  void reducedPrecision (const Points &srcs, const Points &dsts,
+                         std::vector<float> &outputs,
+                         genotype::cppn::Output o, Context &context) const;
+  /// @}
+
+  /// \name Grid queries
+  /// Batch queries between a point and every point of a regular grid (e.g.
+  /// the pixels of an image), with outputs in the same order, bitwise
+  /// identical. Nodes are evaluated only over the grid coordinates they
+  /// depend on: once per row, once per column or once altogether (e.g. the
+  /// first layer of hidden nodes) instead of at every point. Partial sums
+  /// that are constant along rows (or columns) are computed once per row
+  /// (column) and the other terms added with the same float operations
+  /// @{
+  struct Grid {
+    /// Point (r, c) is rows[r] with its first coordinate set to columns[c]
+    Points rows;
+    std::vector<float> columns;
+
+    Point point (uint r, uint c) const {
+      Point p = rows[r];
+      p.set(0, columns[c]);
+      return p;
+    }
+
+    /// Number of points (row by row)
+    uint size (void) const {  return rows.size() * columns.size();  }
+  };
+
+  void operator() (const Point &src, const Grid &dsts,
+                   BatchOutputs &outputs) const;
+
+  void operator() (const Grid &srcs, const Point &dst,
+                   BatchOutputs &outputs) const;
+
+  void operator() (const Point &src, const Grid &dsts,
+                   std::vector<float> &outputs, genotype::cppn::Output o) const;
+
+  void operator() (const Grid &srcs, const Point &dst,
+                   std::vector<float> &outputs, genotype::cppn::Output o) const;
+
+  void operator() (const Point &src, const Grid &dsts,
+                   BatchOutputs &outputs, Context &context) const;
+
+  void operator() (const Grid &srcs, const Point &dst,
+                   BatchOutputs &outputs, Context &context) const;
+
+  void operator() (const Point &src, const Grid &dsts,
+                   std::vector<float> &outputs, genotype::cppn::Output o,
+                   Context &context) const;
+
+  void operator() (const Grid &srcs, const Point &dst,
+                   std::vector<float> &outputs, genotype::cppn::Output o,
+                   Context &context) const;
+  /// @}
+
+  /// \name Interval queries
+  /// Guaranteed bounds on an output over every pair (src, dst) with src and
+  /// dst in the given boxes, i.e. on the values single-pair queries would
+  /// return (including rounding errors). Bounds are propagated through the
+  /// same program with the same float operations which, being monotonic, need
+  /// no outward rounding. Activation functions are padded instead.
+  /// @{
+  struct Box {
+    Point min, max;
+  };
+
+  Range operator() (const Box &srcs, const Box &dsts,
+                    genotype::cppn::Output o) const;
+
+  Range operator() (const Box &srcs, const Box &dsts,
+                    genotype::cppn::Output o, Context &context) const;
+  /// @}
+
+  /// \name Derivative queries
+  /// Forward-mode evaluation of every output together with its first and
+  /// second partial derivatives with respect to each coordinate of src (if
+  /// source) or dst (mixed second derivatives are not computed). Values are
+  /// bitwise identical to those of single-pair queries.
+  /// Activation functions are differentiated through activations::derivatives
+  /// @{
+  using Derivatives = std::array<activations::Derivatives, DIMENSIONS>;
+  using OutputsDerivatives = std::array<Derivatives, OUTPUTS>;
+
+  void derivatives (const Point &src, const Point &dst, bool source,
+                    Outputs &outputs, OutputsDerivatives &derivatives) const;
+
+  void derivatives (const Point &src, const Point &dst, bool source,
+                    Outputs &outputs, OutputsDerivatives &derivatives,
+                    Context &context) const;
+  /// @}
+
+  /// \name Incremental queries
+  /// Batch queries of every output keeping the values of all nodes, from
+  /// which another CPPN (typically a mutated child) can be evaluated at the
+  /// same points by recomputing only what changed. Outputs are bitwise
+  /// identical to those of the batch queries. Specialized CPPNs cannot be
+  /// traced (nor retraced): both throw
+  /// @{
+  using NodeID = genotype::ES_HyperNEAT::CPPN::Node::ID;
+
+  struct Trace {
+    Points srcs, dsts;
+
+    /// Whether values can be reused (recurrent CPPNs' cannot)
+    bool reusable = false;
+
+    /// How a node was computed: function of the weighted sum of other nodes
+    struct Node {
+      Function func;
+      std::vector<std::pair<NodeID, float>> links;  ///< In evaluation order
+      uint row;                                     ///< In values
+    };
+    std::map<NodeID, Node> nodes;
+
+    /// Same layout as Context::batchData
+    std::vector<float> values;
+  };
+
+  void trace (const Points &srcs, const Points &dsts, BatchOutputs &outputs,
+              Trace &trace) const;
+
+  void trace (const Points &srcs, const Points &dsts, BatchOutputs &outputs,
+              Trace &trace, Context &context) const;
+
+  /// Evaluates this CPPN at the points of another's trace (possibly the same
+  /// object as trace). Nodes with the same function of the same links to
+  /// reused nodes (or inputs) as in previous are copied, the others (i.e.
+  /// those downstream of a mutation) evaluated. Fills trace for this CPPN and
+  /// returns the number of evaluated nodes
+  uint retrace (const Trace &previous, BatchOutputs &outputs,
+                Trace &trace) const;
+
+  uint retrace (const Trace &previous, BatchOutputs &outputs, Trace &trace,
+                Context &context) const;
+  /// @}
+
+private:
+  void pre_evaluation (const Program &p, const Point &src, const Point &dst,
+                       Context &context) const;
+  static void evaluate (const Program &p, Context &context);
+
+  uint pre_evaluation (const Program &p,
+                       const Points &srcs, const Points &dsts,
+                       Context &context) const;
+  static void evaluate (const Program &p, uint n, Context &context,
+                        bool reduced = false);
+  static void evaluate (const Program &p, const Node &node, uint n,
+                        Context &context, bool reduced = false);
+  static void post_evaluation (uint o, uint n, const Context &context,
+                               std::vector<float> &outputs);
+
+  /// Evaluates p over a grid on the side given by source (see Grid queries).
+  /// Output o ends up in outputs[o] for every o in mask
+  void evaluate (const Program &p, const Point &fixed, const Grid &grid,
+                 bool source, uint mask, BatchOutputs &outputs,
+                 Context &context) const;
+
+  /// Stores the values of a batch evaluation of p (moved out of context)
+  void record (const Program &p, const Points &srcs, const Points &dsts,
+               Trace &trace, Context &context) const;
+};
+
+/// Memoizing front-end to a CPPN for repeated queries (e.g. in ANN::build)
+/// Points are stored in fixed-point so that a (src, dst) pair is an exact key.
+/// Every miss evaluates all outputs at once: later queries for the same pair,
+/// whatever the output, are served from memory with identical values.
+/// Cyclic CPPNs and disabled caches forward every query (counted as misses)
+class QueryCache {
+public:
+  QueryCache (const CPPN &cppn, bool enabled = true);
+
+  float operator() (const Point &src, const Point &dst,
+                    genotype::cppn::Output o);
+
+  /// Batch query with the same pairing rules as the CPPN
+  void operator() (const CPPN::Points &srcs, const CPPN::Points &dsts,
+                   std::vector<float> &outputs, genotype::cppn::Output o);
+
+  /// Batch query of a subset of the outputs (the others are left untouched)
+  void operator() (const CPPN::Points &srcs, const CPPN::Points &dsts,
+                   CPPN::BatchOutputs &outputs,
+                   const CPPN::OutputSubset &oset);
+
+  /// Whether outputs queried together have the values they would have if
+  /// queried separately. Always true when caching (every output of a pair
+  /// is then computed at once), otherwise only for acyclic CPPNs
+  bool consistent (void) const {
+    return _enabled || _cppn.acyclic();
+  }
+
+  /// Evaluates subsequent queries whose source (or destination) is p through
+  /// a residual CPPN (see CPPN::specialize)
+  void specialize (const Point &p, bool source);
+
+  /// Reduced-precision batch query (never cached)
+  void reducedPrecision (const CPPN::Points &srcs, const CPPN::Points &dsts,
+                         std::vector<float> &outputs, genotype::cppn::Output o);
+
+  /// Derivative query with respect to src (if source) or dst. Evaluates
+  /// every output, whose values are then cached (derivatives never are)
+  float derivatives (const Point &src, const Point &dst,
+                     genotype::cppn::Output o, bool source,
+                     CPPN::Derivatives &derivatives);
+
+  /// Interval query (never cached)
+  CPPN::Range operator() (const CPPN::Box &srcs, const CPPN::Box &dsts,
+                          genotype::cppn::Output o);
+
+  bool enabled (void) const {   return _enabled;  }
+
+  /// Number of queries answered from memory
+  uint hits (void) const {      return _hits;     }
+
+  /// Number of queries requiring an evaluation
+  uint misses (void) const {    return _misses;   }
+
 private:
-  void pre_evaluation (const Point &src, const Point &dst) const;
+  struct Key {
+    Point src, dst;
+    friend bool operator== (const Key &lhs, const Key &rhs) {
+      return lhs.src == rhs.src && lhs.dst == rhs.dst;
+    }
+  };
+  struct KeyHash {
+    size_t operator() (const Key &k) const noexcept {
+      size_t h = std::hash<Point>()(k.src);
+      return h ^ (std::hash<Point>()(k.dst) + 0x9e3779b9 + (h<<6) + (h>>2));
+    }
+  };
+
+  const CPPN &_cppn;
+  const bool _enabled;
+
+  CPPN _residual;
+  Point _fixed;
+  bool _source;
+  bool _specialized;
+
+  /// CPPN to use for queries whose sources (resp. destinations) are all p
+  const CPPN& cppn (const CPPN::Points &srcs,
+                    const CPPN::Points &dsts) const;
+  const CPPN& cppn (const Point &src, const Point &dst) const;
+  uint _hits, _misses;
+
+  /// Element i of a batch of n pairs (the single point being paired with all)
+  static const Point& point (const CPPN::Points &points, uint n, uint i) {
+    return points.size() == n ? points[i] : points.front();
+  }
+
+  /// Evaluates (and caches) the unknown pairs of a batch, returning its size
+  uint batch (const CPPN::Points &srcs, const CPPN::Points &dsts);
+
+  std::unordered_map<Key, CPPN::Outputs, KeyHash> _entries;
+
+  CPPN::Context _context;
+
+  /// Unknown pairs of the current batch and where to store their outputs
+  CPPN::Points _msrcs, _mdsts;
+  std::vector<CPPN::Outputs*> _mentries;
+  CPPN::BatchOutputs _moutputs;
 };
 
 } // end of namespace phenotype
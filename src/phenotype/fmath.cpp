@@ -0,0 +1,129 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "fmath.h"
+
+namespace phenotype {
+
+float fd_exp(float x) {
+  return static_cast<double(*)(double)>(std::exp)(x);
+}
+
+float fd_sin(float x) {
+  return static_cast<double(*)(double)>(std::sin)(x);
+}
+
+// =============================================================================
+// Coefficients and reductions from the Cephes library (expf.c, sinf.c), with
+//  a more accurate argument reduction for the sine
+// Must be compiled without floating-point contraction (see CMakeLists.txt):
+//  a fused multiply-add would change the results depending on the target
+
+namespace {
+
+/// 2^e for e in [-126, 127]
+float pow2 (int e) {
+  uint32_t bits = uint32_t(e + 127) << 23;
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+} // end of anonymous namespace
+
+float ff_exp (float x) {
+  static constexpr float MAXLOG = 88.72283905206835f;   // log(FLT_MAX)
+  static constexpr float MINLOG = -103.972077083991796f; // log(2^-150)
+  static constexpr float LOG2E = 1.44269504088896341f;
+  static constexpr float C1 = 0.693359375f;   // ln(2) = C1 + C2 (C1 exact)
+  static constexpr float C2 = -2.12194440e-4f;
+
+  if (std::isnan(x))  return x;
+  if (x > MAXLOG)     return INFINITY;
+  if (x < MINLOG)     return 0.f;
+
+  // x = k ln(2) + r, |r| <= ln(2)/2 (truncation-based floor: std::floor is
+  // a library call on baseline x86-64)
+  float t = LOG2E * x + .5f;
+  int n = t;
+  if (t < n)  n--;
+  float k = n;
+  float r = x - k * C1;
+  r = r - k * C2;
+
+  // e^r = 1 + r + r^2 P(r)
+  float z = r * r;
+  float p = 1.9875691500e-4f;
+  p = p * r + 1.3981999507e-3f;
+  p = p * r + 8.3334519073e-3f;
+  p = p * r + 4.1665795894e-2f;
+  p = p * r + 1.6666665459e-1f;
+  p = p * r + 5.0000001201e-1f;
+  p = p * z + r + 1.f;
+
+  // e^x = 2^k e^r with a single rounding (even for subnormal results)
+  if (n > 127)        return p * pow2(127) * pow2(n - 127);
+  else if (n < -126)  return p * pow2(n + 64) * pow2(-64);
+  else                return p * pow2(n);
+}
+
+float ff_sin (float x) {
+  static constexpr float FOPI = 1.27323954473516f;  // 4 / pi
+  // pi/4 = DP1 + ... + DP5 (+ 3e-18), 10 significant bits each so that their
+  // products with the octant (< 2^14) are exact
+  static constexpr float DP1 = 0x1.92p-1f;
+  static constexpr float DP2 = 0x1.fb8p-13f;
+  static constexpr float DP3 = -0x1.5ep-24f;
+  static constexpr float DP4 = 0x1.0b8p-35f;
+  static constexpr float DP5 = -0x1.cf8p-46f;
+  static constexpr float LOSSTH = 8192.f;
+  static constexpr float TWOPI = 6.28318530717958648f;
+
+  if (!std::isfinite(x))  return x - x; // NaN
+
+  float sign = 1;
+  if (x < 0) {
+    sign = -1;
+    x = -x;
+  }
+
+  // Beyond that the reduction below loses all precision. Inputs of such
+  // magnitude are meaningless anyway: fmod is exact and thus deterministic
+  if (x > LOSSTH) x = std::fmod(x, TWOPI);
+
+  // Octant and reduced argument in [-pi/4, pi/4]
+  int j = FOPI * x;
+  float y = j;
+  if (j & 1) {
+    j += 1;
+    y += 1;
+  }
+  j &= 7;
+  if (j > 3) {
+    sign = -sign;
+    j -= 4;
+  }
+
+  x = ((((x - y * DP1) - y * DP2) - y * DP3) - y * DP4) - y * DP5;
+  float z = x * x;
+
+  if (j == 1 || j == 2) {
+    y = 2.443315711809948e-5f;
+    y = y * z - 1.388731625493765e-3f;
+    y = y * z + 4.166664568298827e-2f;
+    y = y * z * z;
+    y = y - .5f * z;
+    y = y + 1.f;
+  } else {
+    y = -1.9515295891e-4f;
+    y = y * z + 8.3321608736e-3f;
+    y = y * z - 1.6666654611e-1f;
+    y = y * z * x;
+    y = y + x;
+  }
+
+  return sign * y;
+}
+
+} // end of namespace phenotype
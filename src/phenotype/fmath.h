@@ -0,0 +1,37 @@
+#ifndef KGD_FMATH_H
+#define KGD_FMATH_H
+
+namespace phenotype {
+
+// =============================================================================
+// -- Deterministic transcendental functions
+// Results of the CPPN/ANN must be bitwise identical across machines. The libm
+//  float functions do not guarantee that (divergences were observed between
+//  local and remote machines), hence the two alternatives below.
+
+/// Double-precision exp/sin truncated to float
+/// Relies on the double libm being correctly rounded (or nearly so) everywhere
+float fd_exp (float x);
+float fd_sin (float x);
+
+/// Float-only exp/sin with fixed polynomial coefficients and evaluation order
+/// Only uses IEEE-754 basic operations (compiled without contraction) and is
+///  thus reproducible across compilers, libm and (x86-64/arm64) machines.
+/// Accuracy: < 1 ulp (exp), < 2 ulps (sin, up to |x| ~ 1000). See tests/fmath
+float ff_exp (float x);
+float ff_sin (float x);
+
+} // end of namespace phenotype
+
+/// Implementation used by the activation functions (cmake ESHN_FLOAT_MATH)
+#if ESHN_FLOAT_MATH
+#define KGD_EXP phenotype::ff_exp
+#define KGD_SIN phenotype::ff_sin
+#define KGD_EXP_STR "fexp"
+#else
+#define KGD_EXP phenotype::fd_exp
+#define KGD_SIN phenotype::fd_sin
+#define KGD_EXP_STR "dexp"
+#endif
+
+#endif // KGD_FMATH_H
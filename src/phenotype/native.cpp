@@ -0,0 +1,165 @@
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "native.h"
+
+namespace phenotype::native {
+
+namespace stdfs = std::filesystem;
+
+namespace {
+
+/// Floating-point contraction would break the bitwise identity with the
+/// interpreter (which performs separate multiplications and additions)
+const std::string FLAGS = "-std=c++17 -O2 -fPIC -shared -ffp-contract=off";
+
+std::string compiler (void) {
+  const char *cxx = std::getenv("ESHN_CXX");
+  return cxx ? cxx : "c++";
+}
+
+/// Per-user by default: loading objects from a folder writable by others
+/// would run their code
+stdfs::path cacheFolder (void) {
+  if (const char *path = std::getenv("ESHN_NATIVE_CACHE"))  return path;
+  if (const char *path = std::getenv("XDG_CACHE_HOME"); path && *path)
+    return stdfs::path(path) / "eshn-native";
+  const char *home = std::getenv("HOME");
+  if (!home || !*home) {
+    const passwd *pw = ::getpwuid(::geteuid());
+    if (!pw)  return stdfs::path();
+    home = pw->pw_dir;
+  }
+  return stdfs::path(home) / ".cache" / "eshn-native";
+}
+
+/// Creates folder (private) if needed and checks that no one else can write
+/// into it: a real directory, owned by the effective user and neither group
+/// nor world writable
+bool secure (const stdfs::path &folder) {
+  if (folder.empty()) return false;
+  std::error_code ec;
+  stdfs::create_directories(folder.parent_path(), ec);
+  if (::mkdir(folder.c_str(), 0700) != 0 && errno != EEXIST)  return false;
+
+  struct stat st;
+  return ::lstat(folder.c_str(), &st) == 0
+      && S_ISDIR(st.st_mode)
+      && st.st_uid == ::geteuid()
+      && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+/// Creates a new file folder/<prefix>XXXXXX<suffix> (never an existing one,
+/// nor through a symbolic link) holding contents. Returns its path or an
+/// empty one on failure
+stdfs::path createUnique (const stdfs::path &folder, const std::string &prefix,
+                          const std::string &suffix,
+                          const std::string &contents = "") {
+  std::string path = (folder / (prefix + "XXXXXX" + suffix)).string();
+  int fd = ::mkstemps(path.data(), suffix.size());
+  if (fd < 0) return stdfs::path();
+
+  bool ok = true;
+  for (size_t written = 0; ok && written < contents.size(); ) {
+    ssize_t n = ::write(fd, contents.data() + written,
+                        contents.size() - written);
+    ok = (n > 0);
+    if (ok) written += n;
+  }
+  ok = (::close(fd) == 0) && ok;
+  if (!ok) {
+    std::error_code ec;
+    stdfs::remove(path, ec);
+    return stdfs::path();
+  }
+  return path;
+}
+
+/// Single-quoted for the shell, which does not interpret backslashes there:
+/// embedded quotes close the string, are escaped and reopen it ('\'')
+std::string quoted (const stdfs::path &p) {
+  std::string q = "'";
+  for (char c: p.string()) {
+    if (c == '\'') q += "'\\''";
+    else            q += c;
+  }
+  return q + "'";
+}
+
+bool sameContents (const stdfs::path &path, const std::string &source) {
+  std::ifstream ifs (path);
+  if (!ifs) return false;
+  std::ostringstream oss;
+  oss << ifs.rdbuf();
+  return oss.str() == source;
+}
+
+bool build (const stdfs::path &folder, const std::string &name,
+            const std::string &source) {
+  // Unique temporaries, renamed once complete: concurrent processes building
+  // the same object never see (or load) a partial file
+  const std::string tmp = "." + name + ".";
+  stdfs::path src = createUnique(folder, tmp, ".cpp", source);
+  if (src.empty())  return false;
+  stdfs::path obj = createUnique(folder, tmp, ".so");
+  std::error_code ec;
+  if (obj.empty()) {
+    stdfs::remove(src, ec);
+    return false;
+  }
+
+  std::string cmd = compiler() + " " + FLAGS + " -o " + quoted(obj) + " "
+                  + quoted(src) + " > /dev/null 2>&1";
+  bool ok = (std::system(cmd.c_str()) == 0);
+
+  if (ok) stdfs::rename(obj, folder / (name + ".so"), ec);
+  if (ok && !ec) stdfs::rename(src, folder / (name + ".cpp"), ec);
+  ok = ok && !ec;
+
+  stdfs::remove(src, ec);
+  stdfs::remove(obj, ec);
+  return ok;
+}
+
+} // end of anonymous namespace
+
+Library load (const std::string &source) {
+  // The compiler is part of the key: a cached object might not have been
+  // built with the one requested now
+  std::string fullSource = "// " + compiler() + " " + FLAGS + "\n" + source;
+  std::ostringstream name;
+  name << "cppn-" << std::hex << std::setfill('0') << std::setw(16)
+       << std::hash<std::string>()(fullSource);
+
+  // Refused folders fall back to the interpreter
+  stdfs::path folder = cacheFolder();
+  if (!secure(folder))  return Library();
+
+  std::error_code ec;
+  stdfs::path obj = folder / (name.str() + ".so");
+  if (!(stdfs::exists(obj, ec)
+        && sameContents(folder / (name.str() + ".cpp"), fullSource))
+      && !build(folder, name.str(), fullSource))
+    return Library();
+
+  void *handle = ::dlopen(obj.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!handle)  return Library();
+  return Library(handle, [] (void *h) { ::dlclose(h); });
+}
+
+void* symbol (const Library &l, const std::string &name) {
+  if (!l) return nullptr;
+  return ::dlsym(l.get(), name.c_str());
+}
+
+} // end of namespace phenotype::native
@@ -0,0 +1,32 @@
+#ifndef KGD_NATIVE_H
+#define KGD_NATIVE_H
+
+#include <memory>
+#include <string>
+
+namespace phenotype::native {
+
+// =============================================================================
+// -- Run-time compilation of generated code (see CPPN::compile)
+// Shared objects are built by the local compiler ($ESHN_CXX, defaults to c++)
+//  and cached on disk ($ESHN_NATIVE_CACHE, defaults to
+//  $XDG_CACHE_HOME/eshn-native or ~/.cache/eshn-native) under the hash of
+//  their source. Sources are kept alongside so that a hash collision merely
+//  triggers a recompilation.
+// The cache folder is created private (0700) and refused (i.e. no native
+//  code) unless it is owned by the effective user and writable by no one else.
+
+/// Handle to a loaded shared object, unloaded with its last copy
+using Library = std::shared_ptr<void>;
+
+/// Compiles (unless cached) and loads the given source
+/// Returns an empty handle if any of these steps failed (e.g. no compiler,
+/// unsafe cache folder)
+Library load (const std::string &source);
+
+/// Address of an (extern "C") symbol of l or nullptr
+void* symbol (const Library &l, const std::string &name);
+
+} // end of namespace phenotype::native
+
+#endif // KGD_NATIVE_H
@@ -140,6 +140,8 @@ public:
     using utils::assertEqual;
     assertEqual(lhs._data, rhs._data, deepcopy);
   }
+
+  friend struct std::hash<Point_t>;
 };
 using Point2D = Point_t<2, 3>;
 using Point3D = Point_t<3, 3>;
@@ -147,4 +149,19 @@ using Point = Point_t<ESHN_SUBSTRATE_DIMENSION, 3>;
 
 } // end of namespace phenotype
 
+namespace std {
+
+/// Exact (fixed-point) hashing
+template <uint DI, uint DE>
+struct hash<phenotype::Point_t<DI, DE>> {
+  size_t operator() (const phenotype::Point_t<DI, DE> &p) const noexcept {
+    size_t h = 0;
+    for (int v: p._data)
+      h = h * 0x100000001b3ull ^ std::hash<int>()(v);
+    return h;
+  }
+};
+
+} // end of namespace std
+
 #endif // ES_HYPERNEAT_POINT_HPP
@@ -0,0 +1,76 @@
+#include "threadpool.h"
+
+namespace phenotype {
+
+ThreadPool::ThreadPool (uint n)
+  : _task(nullptr), _items(0), _next(0), _busy(0), _generation(0),
+    _stop(false) {
+  for (uint w=1; w<n; w++)  _threads.emplace_back(&ThreadPool::work, this, w);
+}
+
+ThreadPool::~ThreadPool (void) {
+  {
+    std::lock_guard lock (_mutex);
+    _stop = true;
+  }
+  _start.notify_all();
+  for (std::thread &t: _threads)  t.join();
+}
+
+void ThreadPool::run (uint n, const Task &task) {
+  if (_threads.empty() || n <= 1) {
+    for (uint i=0; i<n; i++)  task(i, 0);
+    return;
+  }
+
+  {
+    std::lock_guard lock (_mutex);
+    _task = &task;
+    _items = n;
+    _next = 0;
+    _busy = _threads.size();
+    _error = nullptr;
+    _generation++;
+  }
+  _start.notify_all();
+
+  loop(0);
+
+  std::unique_lock lock (_mutex);
+  _done.wait(lock, [this] { return _busy == 0; });
+  _task = nullptr;
+  if (_error) std::rethrow_exception(_error);
+}
+
+void ThreadPool::work (uint worker) {
+  uint generation = 0;
+  while (true) {
+    {
+      std::unique_lock lock (_mutex);
+      _start.wait(lock, [this, generation] {
+        return _stop || _generation != generation;
+      });
+      if (_stop)  return;
+      generation = _generation;
+    }
+
+    loop(worker);
+
+    std::lock_guard lock (_mutex);
+    if (--_busy == 0) _done.notify_one();
+  }
+}
+
+void ThreadPool::loop (uint worker) {
+  for (uint i; (i = _next++) < _items; ) {
+    try {
+      (*_task)(i, worker);
+    } catch (...) {
+      std::lock_guard lock (_mutex);
+      if (!_error)  _error = std::current_exception();
+      _next = _items;
+    }
+  }
+}
+
+} // end of namespace phenotype
@@ -0,0 +1,60 @@
+#ifndef KGD_THREADPOOL_H
+#define KGD_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace phenotype {
+
+/// Fixed set of workers for indexed loops (e.g. the points explored by
+/// ANN::build). The calling thread is one of them. Items are handed out in
+/// no particular order: callers needing deterministic results store them by
+/// item and merge them afterwards
+class ThreadPool {
+public:
+  /// Work is done by the caller and n-1 additional threads
+  explicit ThreadPool (uint n);
+  ~ThreadPool (void);
+
+  ThreadPool (const ThreadPool&) = delete;
+  ThreadPool& operator= (const ThreadPool&) = delete;
+
+  /// Number of workers (the caller included)
+  uint size (void) const {  return _threads.size() + 1; }
+
+  /// Called with an item and the index of the worker (in [0, size()))
+  using Task = std::function<void(uint item, uint worker)>;
+
+  /// Calls task for every item in [0, n) and returns once all are done
+  /// The first exception thrown by a task (if any) is rethrown here, items
+  /// not yet started being skipped. Not reentrant
+  void run (uint n, const Task &task);
+
+private:
+  std::vector<std::thread> _threads;
+
+  std::mutex _mutex;
+  std::condition_variable _start, _done;
+
+  const Task *_task;
+  uint _items;
+  std::atomic<uint> _next;
+
+  uint _busy;       ///< Threads still working on the current run
+  uint _generation; ///< Number of runs so far (wakes up the threads)
+  bool _stop;
+
+  std::exception_ptr _error;
+
+  void work (uint worker);
+  void loop (uint worker);
+};
+
+} // end of namespace phenotype
+
+#endif // KGD_THREADPOOL_H
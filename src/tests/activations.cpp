@@ -0,0 +1,205 @@
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include "../phenotype/cppn.h"
+
+/// Checks that every batch kernel, for every instruction set supported by the
+/// current CPU, is bitwise identical to the scalar function it replaces
+int main (void) {
+  using phenotype::CPPN;
+  namespace activations = phenotype::activations;
+  using IS = activations::InstructionSet;
+  using FuncID = CPPN::FuncID;
+
+  std::vector<float> values {
+    0.f, -0.f, 1.f, -1.f, 1e-3f, -1e-3f, .5f, -.5f, 2.f, -2.f, 100.f, -100.f,
+    std::numeric_limits<float>::min(), -std::numeric_limits<float>::min(),
+    std::numeric_limits<float>::denorm_min(),
+    -std::numeric_limits<float>::denorm_min(),
+    std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(),
+    std::numeric_limits<float>::infinity(),
+    -std::numeric_limits<float>::infinity(),
+    std::numeric_limits<float>::quiet_NaN(),
+  };
+
+  // Dense sweep over the interesting range and around the ssgn thresholds
+  static constexpr uint SWEEP = 1 << 20;
+  for (uint i=0; i<SWEEP; i++) values.push_back(-10 + 20.f * i / SWEEP);
+  for (float x: {-1.f, 1.f}) {
+    float lo = x, hi = x;
+    for (uint i=0; i<1000; i++) {
+      values.push_back(lo = std::nextafter(lo, -INFINITY));
+      values.push_back(hi = std::nextafter(hi, +INFINITY));
+    }
+  }
+
+  // Random bit patterns
+  std::mt19937 rng (0);
+  for (uint i=0; i<SWEEP; i++) {
+    uint32_t bits = rng();
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    values.push_back(f);
+  }
+
+  // Odd size to exercise the scalar tails
+  values.push_back(0);
+
+  std::vector<float> outputs (values.size());
+  uint failures = 0;
+  for (IS is: { IS::SCALAR, IS::SSE2, IS::AVX2 }) {
+    if (!activations::supported(is)) {
+      std::cout << "Skipping unsupported instruction set " << is << "\n";
+      continue;
+    }
+
+    for (uint fi=0; fi<FuncID::SIZE; fi++) {
+      FuncID f = FuncID::Value(fi);
+      activations::kernel(f, is)(values.data(), outputs.data(), values.size());
+
+      uint errors = 0;
+      for (uint i=0; i<values.size(); i++) {
+        float ref = CPPN::functions[f](values[i]);
+        if (std::memcmp(&ref, &outputs[i], sizeof(float)) != 0) {
+          if (errors++ < 5)
+            std::cerr << "\t" << f << "(" << std::hexfloat << values[i]
+                      << ") = " << ref << " != " << outputs[i]
+                      << std::defaultfloat << "\n";
+        }
+      }
+
+      std::cout << std::setw(6) << is << " " << std::setw(4) << f << ": "
+                << (errors ? "FAILED" : "ok") << " (" << values.size()
+                << " values, " << errors << " mismatches)" << std::endl;
+      failures += errors;
+    }
+  }
+
+  // Tabulated mode: kernels must stay within the documented errors of the
+  // exact functions (same padding as the interval extensions) over the
+  // sampled range. Large sines are wrapped with a rounded period and thus not
+  // checked
+  config::Activations::tabulated() = true;
+  const auto tErrors = activations::tabulationErrors();
+  const float sampled =
+    2 * std::max(config::Activations::tableDomain(), float(M_PI));
+  for (uint fi=0; fi<FuncID::SIZE; fi++) {
+    FuncID f = FuncID::Value(fi);
+    activations::kernel(f)(values.data(), outputs.data(), values.size());
+    auto it = tErrors.find(f);
+    float tolerance = (it != tErrors.end()) ? 2 * it->second.absolute : 0;
+
+    uint errors = 0;
+    float maxError = 0;
+    for (uint i=0; i<values.size(); i++) {
+      float ref = CPPN::functions[f](values[i]);
+      if (std::isnan(values[i]))
+        errors += (std::isnan(ref) != std::isnan(outputs[i]));
+      else if (std::isnan(ref)) // Overflowing exact function (e.g. sin(2x))
+        continue;
+      else if (f != FuncID::SIN || std::fabs(values[i]) <= sampled) {
+        float error = (ref == outputs[i]) ? 0 : std::fabs(ref - outputs[i]);
+        if (!(error <= tolerance) && errors < 5)
+          std::cerr << "\t" << f << "(" << std::hexfloat << values[i]
+                    << ") = " << ref << " != " << outputs[i]
+                    << std::defaultfloat << "\n";
+        maxError = std::max(maxError, error);
+        errors += !(error <= tolerance);
+      }
+    }
+    std::cout << " table " << std::setw(4) << f << ": "
+              << (errors ? "FAILED" : "ok") << " (" << values.size()
+              << " values, " << errors << " beyond " << tolerance
+              << ", max error " << maxError << ")" << std::endl;
+    failures += errors;
+
+    // Interval extensions hold for the tables too, including far beyond the
+    // sampled range
+    const auto bounds = activations::bounds(f);
+    uint escapes = 0;
+    for (uint i=0; i<values.size(); i++) {
+      if (std::isnan(values[i]) || std::isnan(outputs[i]))  continue;
+      activations::Range r = bounds({values[i], values[i]});
+      bool escaped = !(r.min <= outputs[i] && outputs[i] <= r.max);
+      if (escaped && escapes < 5)
+        std::cerr << "\t" << f << "(" << std::hexfloat << values[i]
+                  << ") = " << outputs[i] << " not in [" << r.min << ", "
+                  << r.max << "]" << std::defaultfloat << "\n";
+      escapes += escaped;
+    }
+    std::cout << "bounds " << std::setw(4) << f << ": "
+              << (escapes ? "FAILED" : "ok") << " (" << escapes
+              << " escapes)" << std::endl;
+    failures += escapes;
+  }
+  config::Activations::tabulated() = false;
+
+  // Reduced precision: instruction-set independent, within the documented
+  // errors (for inputs of reasonable magnitude)
+  std::cout << "\nReduced precision kernels:\n";
+  for (uint fi=0; fi<FuncID::SIZE; fi++) {
+    FuncID f = FuncID::Value(fi);
+    std::vector<float> reference (values.size());
+    activations::reducedKernel(f, IS::SCALAR)(values.data(), reference.data(),
+                                              values.size());
+
+    uint errors = 0;
+    for (IS is: { IS::SSE2, IS::AVX2 }) {
+      if (!activations::supported(is)) continue;
+      activations::reducedKernel(f, is)(values.data(), outputs.data(),
+                                        values.size());
+      errors += std::memcmp(reference.data(), outputs.data(),
+                            values.size() * sizeof(float)) != 0;
+    }
+
+    float maxError = 0;
+    for (uint i=0; i<values.size(); i++) {
+      if (!(std::fabs(values[i]) < 1e5))  continue;
+      float exact = CPPN::functions[f](values[i]);
+      maxError = std::max(maxError, std::fabs(reference[i] - exact));
+    }
+    if (!(maxError < 1e-5)) errors++;
+
+    std::cout << std::setw(6) << f << ": " << (errors ? "FAILED" : "ok")
+              << " (max error " << maxError << ")" << std::endl;
+    failures += errors;
+  }
+
+  // Derivatives against central finite differences (in double precision)
+  std::cout << "\nDerivatives:\n";
+  for (uint fi=0; fi<FuncID::SIZE; fi++) {
+    FuncID f = FuncID::Value(fi);
+    activations::DerivativesFunction df = activations::derivatives(f);
+    const auto func = [f] (double x) { return double(CPPN::functions[f](x)); };
+
+    float maxError1 = 0, maxError2 = 0;
+    for (double x = -5; x <= 5; x += 1e-3) {
+      static constexpr double h = 1e-2;
+      // Skip the neighbourhood of discontinuities (abs and step at 0, second
+      // derivative of ssgn at +/- 1)
+      if (std::fabs(x) < 2*h || std::fabs(std::fabs(x) - 1) < 2*h) continue;
+      double d1 = (func(x+h) - func(x-h)) / (2*h),
+             d2 = (func(x+h) - 2*func(x) + func(x-h)) / (h*h);
+      activations::Derivatives d = df(x);
+      maxError1 = std::max(maxError1, float(std::fabs(d.first - d1)));
+      maxError2 = std::max(maxError2, float(std::fabs(d.second - d2)));
+    }
+    bool error = !(maxError1 < 1e-2 && maxError2 < 1e-1);
+
+    std::cout << std::setw(6) << f << ": " << (error ? "FAILED" : "ok")
+              << " (max errors " << maxError1 << ", " << maxError2 << ")"
+              << std::endl;
+    failures += error;
+  }
+
+  std::cout << "\nTabulation errors (" << config::Activations::tableResolution()
+            << " samples per unit over +/- "
+            << config::Activations::tableDomain() << "):\n";
+  for (const auto &p: activations::tabulationErrors())
+    std::cout << std::setw(6) << p.first << ": " << p.second.absolute
+              << " (" << 100 * p.second.relative << "% of range)\n";
+
+  return failures > 0;
+}
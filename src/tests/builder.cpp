@@ -0,0 +1,57 @@
+#include <iostream>
+
+#include "../phenotype/ann.h"
+
+/// Checks that reusing an ESBuilder (explicitly or through the per-thread one
+/// of the convenience ANN::build) across builds of different genomes and
+/// substrates gives the same ANNs as fresh workspaces
+int main (int argc, char *argv[]) {
+  using Genotype = genotype::ES_HyperNEAT;
+  using phenotype::ANN;
+  using phenotype::CPPN;
+
+  const uint genomes = argc > 1 ? std::stoi(argv[1]) : 100;
+
+  // Substrates of decreasing then increasing sizes, so that the buffers left
+  // by a build are both larger and smaller than needed by the next
+  std::vector<std::pair<ANN::Coordinates, ANN::Coordinates>> substrates;
+  for (uint n: {3, 1, 5}) {
+    ANN::Coordinates inputs, outputs;
+    for (uint i=0; i<n; i++) {
+      float x = n > 1 ? -1 + 2.f * i / (n-1) : 0;
+#if ESHN_SUBSTRATE_DIMENSION == 2
+      inputs.push_back({x, -1});
+      outputs.push_back({x/2, 1});
+#elif ESHN_SUBSTRATE_DIMENSION == 3
+      inputs.push_back({x, -1, x});
+      outputs.push_back({x/2, 1, 0});
+#endif
+    }
+    substrates.emplace_back(inputs, outputs);
+  }
+
+  rng::FastDice dice (0);
+  phenotype::ESBuilder builder;
+  uint failures = 0;
+  for (uint g=0; g<genomes; g++) {
+    auto genotype = Genotype::random(dice);
+    for (uint i=0; i<g%100; i++)  genotype.mutate(dice);
+    auto cppn = CPPN::fromGenotype(genotype);
+
+    const auto &[inputs, outputs] = substrates[g % substrates.size()];
+    phenotype::ESBuilder fresh;
+    const ANN reference = ANN::build(inputs, outputs, cppn, fresh);
+    try {
+      assertEqual(ANN::build(inputs, outputs, cppn, builder), reference, true);
+      assertEqual(ANN::build(inputs, outputs, cppn), reference, true);
+    } catch (const std::exception &e) {
+      if (failures < 5)
+        std::cerr << "\tgenome " << g << ": " << e.what() << std::endl;
+      failures++;
+    }
+  }
+
+  std::cout << "reused builders (" << genomes << " genomes): "
+            << (failures ? "FAILED" : "ok") << std::endl;
+  return failures > 0;
+}
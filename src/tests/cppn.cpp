@@ -1,7 +1,27 @@
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <ostream>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../phenotype/ann.h"
 #include "../phenotype/cppn.h"
 
+template <typename T>
+bool identical (const T &lhs, const T &rhs) {
+  return lhs.size() == rhs.size()
+      && std::memcmp(lhs.data(), rhs.data(), sizeof(lhs[0]) * lhs.size()) == 0;
+}
+
+bool identical (const phenotype::CPPN::BatchOutputs &lhs,
+                const phenotype::CPPN::BatchOutputs &rhs) {
+  for (uint i=0; i<lhs.size(); i++)
+    if (!identical(lhs[i], rhs[i])) return false;
+  return true;
+}
+
 int main (void) {
   rng::FastDice dice (0);
 
@@ -9,6 +29,12 @@ int main (void) {
   using CPPN = Genotype::CPPN;
   Genotype::printMutationRates(std::cout, 3);
 
+  uint failures = 0;
+  const auto check = [&failures] (const std::string &what, bool ok) {
+    std::cout << what << ": " << (ok ? "ok" : "FAILED") << std::endl;
+    failures += !ok;
+  };
+
   auto genotype = Genotype::random(dice);
   std::cout << "random genotype: " << genotype << std::endl;
 //  genotype.cppn.graphviz_render_graph("random.pdf");
@@ -37,6 +63,262 @@ int main (void) {
     assertEqual(genotype, genotype2, true);
   }
 
+  {
+    // Child evaluated from its parent's values
+    using Points = phenotype::CPPN::Points;
+    Points srcs, dsts;
+    for (uint i=0; i<1000; i++) {
+      srcs.push_back({dice(-1.f, 1.f), dice(-1.f, 1.f)});
+      dsts.push_back({dice(-1.f, 1.f), dice(-1.f, 1.f)});
+    }
+
+    auto parent = phenotype::CPPN::fromGenotype(genotype);
+    phenotype::CPPN::Trace trace;
+    phenotype::CPPN::BatchOutputs outputs, reference;
+    parent.trace(srcs, dsts, outputs, trace);
+
+    auto child_g = genotype;
+    child_g.mutate(dice);
+    auto child = phenotype::CPPN::fromGenotype(child_g);
+    uint evaluated = child.retrace(trace, outputs, trace);
+    child(srcs, dsts, reference);
+    check("retrace (" + std::to_string(evaluated) + " / "
+          + std::to_string(child.simplification().after.nodes
+                           + Genotype::CPPN::OUTPUTS)
+          + " nodes evaluated)", identical(outputs, reference));
+
+    bool thrown = false;
+    try {
+      child.specialize(srcs.front(), true).trace(srcs, dsts, outputs, trace);
+    } catch (...) {
+      thrown = true;
+    }
+    check("specialized trace refused", thrown);
+  }
+
+  {
+    // Grid queries against the same points, one by one
+    auto cppn = phenotype::CPPN::fromGenotype(genotype);
+    phenotype::CPPN::Grid grid;
+    phenotype::CPPN::Points points;
+    for (uint i=0; i<32; i++) {
+      grid.rows.push_back({0, dice(-1.f, 1.f)});
+      grid.columns.push_back(dice(-1.f, 1.f));
+    }
+    for (uint r=0; r<grid.rows.size(); r++)
+      for (uint c=0; c<grid.columns.size(); c++)
+        points.push_back(grid.point(r, c));
+
+    const phenotype::Point p {dice(-1.f, 1.f), dice(-1.f, 1.f)};
+    phenotype::CPPN::BatchOutputs outputs, reference;
+    cppn(p, grid, outputs);
+    cppn({p}, points, reference);
+    check("grid of destinations", identical(outputs, reference));
+    cppn(grid, p, outputs);
+    cppn(points, {p}, reference);
+    check("grid of sources", identical(outputs, reference));
+  }
+
+  {
+    // Native code against the interpreter, over mutated genomes
+    auto g = genotype;
+    uint compiled = 0, mismatches = 0;
+    for (uint i=0; i<20; i++) {
+      for (uint j=0; j<10; j++) g.mutate(dice);
+      auto cppn = phenotype::CPPN::fromGenotype(g), native = cppn;
+      if (!native.compile())  continue;
+      compiled++;
+
+      using Output = genotype::cppn::Output;
+      for (uint k=0; k<100; k++) {
+        const phenotype::Point src {dice(-1.f, 1.f), dice(-1.f, 1.f)},
+                               dst {dice(-1.f, 1.f), dice(-1.f, 1.f)};
+        phenotype::CPPN::Outputs outputs, reference;
+        cppn(src, dst, reference);
+        native(src, dst, outputs);
+        mismatches += !identical(outputs, reference);
+        cppn(src, dst, reference, {Output::WEIGHT, Output::LEO});
+        native(src, dst, outputs, {Output::WEIGHT, Output::LEO});
+        mismatches += !identical(outputs, reference);
+        for (uint o=0; o<CPPN::OUTPUTS; o++) {
+          float lhs = native(src, dst, Output(o)),
+                rhs = cppn(src, dst, Output(o));
+          mismatches += (std::memcmp(&lhs, &rhs, sizeof(float)) != 0);
+        }
+      }
+    }
+    if (compiled == 0)
+      std::cout << "native: no compiler available, skipped" << std::endl;
+    else {
+      check("native (" + std::to_string(compiled) + " CPPNs)",
+            mismatches == 0);
+
+      // A cache folder others may write into is refused
+      namespace stdfs = std::filesystem;
+      const char *previous = std::getenv("ESHN_NATIVE_CACHE");
+      const std::string saved = previous ? previous : "";
+      stdfs::path folder = stdfs::temp_directory_path()
+                         / ("eshn-unsafe-" + std::to_string(::getpid()));
+      stdfs::create_directory(folder);
+      ::chmod(folder.c_str(), 0777);
+      ::setenv("ESHN_NATIVE_CACHE", folder.c_str(), 1);
+      auto native = phenotype::CPPN::fromGenotype(g);
+      check("native (unsafe cache refused)",
+            !native.compile() && stdfs::is_empty(folder));
+      if (previous) ::setenv("ESHN_NATIVE_CACHE", saved.c_str(), 1);
+      else          ::unsetenv("ESHN_NATIVE_CACHE");
+      stdfs::remove_all(folder);
+    }
+  }
+
+  {
+    // Simplified CPPNs against the full graphs, over mutated genomes and
+    // their recurrent variants (with the weight and leo outputs feeding
+    // each other)
+    using NID = CPPN::Node::ID;
+    using LID = CPPN::Link::ID;
+    auto g = genotype;
+    uint recurrent = 0, mismatches = 0;
+    for (uint i=0; i<20; i++) {
+      for (uint j=0; j<10; j++) g.mutate(dice);
+      auto r = g;
+      r.cppn.links.emplace(LID::next(r.cppn.nextLID), NID(CPPN::INPUTS),
+                           NID(CPPN::INPUTS+1), dice(-1.f, 1.f));
+      r.cppn.links.emplace(LID::next(r.cppn.nextLID), NID(CPPN::INPUTS+1),
+                           NID(CPPN::INPUTS), dice(-1.f, 1.f));
+
+      for (const Genotype &genome: {g, r}) {
+        auto cppn = phenotype::CPPN::fromGenotype(genome),
+             reference = phenotype::CPPN::fromGenotype(genome, false);
+        recurrent += !cppn.acyclic();
+
+        phenotype::CPPN::Points srcs, dsts;
+        for (uint k=0; k<100; k++) {
+          srcs.push_back({dice(-1.f, 1.f), dice(-1.f, 1.f)});
+          dsts.push_back({dice(-1.f, 1.f), dice(-1.f, 1.f)});
+
+          phenotype::CPPN::Outputs outputs, expected;
+          cppn(srcs.back(), dsts.back(), outputs);
+          reference(srcs.back(), dsts.back(), expected);
+          mismatches += !identical(outputs, expected);
+        }
+
+        phenotype::CPPN::BatchOutputs outputs, expected;
+        cppn(srcs, dsts, outputs);
+        reference(srcs, dsts, expected);
+        mismatches += !identical(outputs, expected);
+      }
+    }
+    check("simplification (" + std::to_string(recurrent) + " recurrent CPPNs)",
+          recurrent >= 20 && mismatches == 0);
+  }
+
+  {
+    // Interval queries contain every pointwise output of their boxes, with
+    // exact and tabulated activation functions
+    using Output = genotype::cppn::Output;
+    using Box = phenotype::CPPN::Box;
+    using Point = phenotype::Point;
+    auto &tabulated = config::Activations::tabulated();
+    const bool wasTabulated = tabulated;
+    const auto randomBox = [&dice] {
+      Box b;
+      for (uint i=0; i<Point::DIMENSIONS; i++) {
+        float lhs = dice(-1.f, 1.f), rhs = dice(-1.f, 1.f);
+        b.min.set(i, std::min(lhs, rhs));
+        b.max.set(i, std::max(lhs, rhs));
+      }
+      return b;
+    };
+    const auto randomPoint = [&dice] (const Box &b) {
+      Point p;
+      for (uint i=0; i<Point::DIMENSIONS; i++)
+        p.set(i, dice(b.min.get(i), b.max.get(i)));
+      return p;
+    };
+
+    for (bool t: {false, true}) {
+      tabulated = t;
+      auto g = genotype;
+      uint boxes = 0, escapes = 0;
+      for (uint i=0; i<20; i++) {
+        for (uint j=0; j<10; j++) g.mutate(dice);
+        auto cppn = phenotype::CPPN::fromGenotype(g);
+        for (uint k=0; k<20; k++, boxes++) {
+          const Box srcs = randomBox(), dsts = randomBox();
+          phenotype::CPPN::Range ranges [CPPN::OUTPUTS];
+          for (uint o=0; o<CPPN::OUTPUTS; o++)
+            ranges[o] = cppn(srcs, dsts, Output(o));
+
+          for (uint l=0; l<50; l++) {
+            const Point src = randomPoint(srcs), dst = randomPoint(dsts);
+            for (uint o=0; o<CPPN::OUTPUTS; o++) {
+              float v = cppn(src, dst, Output(o));
+              escapes += !(ranges[o].min <= v && v <= ranges[o].max)
+                       && !std::isnan(ranges[o].min);
+            }
+          }
+        }
+      }
+      check(std::string("intervals (") + (t ? "tabulated" : "exact") + ", "
+            + std::to_string(boxes) + " boxes)", escapes == 0);
+    }
+    tabulated = wasTabulated;
+  }
+
+  {
+    // Interval pruning and the query cache do not change the ANNs
+    using Config = config::EvolvableSubstrate;
+    phenotype::ANN::Coordinates inputs, outputs;
+    for (float x: {-1.f, 0.f, 1.f}) {
+#if ESHN_SUBSTRATE_DIMENSION == 2
+      inputs.push_back({x, -1});
+      outputs.push_back({x/2, 1});
+#elif ESHN_SUBSTRATE_DIMENSION == 3
+      inputs.push_back({x, -1, x});
+      outputs.push_back({x/2, 1, 0});
+#endif
+    }
+
+    auto &intervalPruning = Config::intervalPruning();
+    auto &queryCache = Config::queryCache();
+    const bool wasPruning = intervalPruning, wasCaching = queryCache;
+    const auto build = [&] (const phenotype::CPPN &cppn, bool p, bool c) {
+      intervalPruning = p;
+      queryCache = c;
+      return phenotype::ANN::build(inputs, outputs, cppn);
+    };
+
+    auto g = genotype;
+    uint mismatches = 0;
+    for (uint i=0; i<20; i++) {
+      for (uint j=0; j<10; j++) g.mutate(dice);
+      auto cppn = phenotype::CPPN::fromGenotype(g);
+      const auto reference = build(cppn, false, false);
+      for (uint m=1; m<4; m++) {
+        const bool p = m & 1, c = m & 2;
+        try {
+          assertEqual(build(cppn, p, c), reference, true);
+        } catch (const std::exception &e) {
+          std::cerr << "\tgenome " << i << " (pruning: " << p << ", cache: "
+                    << c << "): " << e.what() << std::endl;
+          mismatches++;
+        }
+      }
+    }
+    intervalPruning = wasPruning;
+    queryCache = wasCaching;
+    check("pruning and caching (20 ANNs)", mismatches == 0);
+  }
+
+  {
+    auto cppn = phenotype::CPPN::fromGenotype(genotype);
+    const auto &s = cppn.simplification();
+    std::cout << "simplified CPPN: " << s.before.nodes << " nodes, "
+              << s.before.links << " links -> " << s.after.nodes << " nodes, "
+              << s.after.links << " links" << std::endl;
+  }
+
 //  std::cout << cppn.dump(1) << std::endl;
 //  genotype.cppn.graphviz_render_graph("mutated.pdf");
 //  genotype.cppn.graphviz_render_graph("mutated.png");
@@ -59,5 +341,5 @@ int main (void) {
   )", dice);
   manual_cppn.render_gvc_graph("manual.png");
 
-  return 0;
+  return failures > 0;
 }
@@ -0,0 +1,94 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../phenotype/fmath.h"
+
+/// Accuracy report and micro-benchmark of the deterministic exp/sin
+/// implementations (double round-trip vs float-only) against libm's double
+/// precision functions
+int main (void) {
+  using Function = float (*) (float);
+  using Reference = double (*) (double);
+
+  struct Candidate {
+    const char *name;
+    Function f;
+  };
+  struct Target {
+    const char *name;
+    Reference ref;
+    float min, max;
+    std::vector<Candidate> candidates;
+  };
+
+  const std::vector<Target> targets {
+    { "exp", static_cast<Reference>(std::exp), -87.f, 88.f,
+      {{ "fd_exp", phenotype::fd_exp }, { "ff_exp", phenotype::ff_exp }} },
+    { "sin", static_cast<Reference>(std::sin), -20.f, 20.f,
+      {{ "fd_sin", phenotype::fd_sin }, { "ff_sin", phenotype::ff_sin }} },
+  };
+
+  static constexpr uint N = 1 << 22;
+  static constexpr uint REPEATS = 10;
+
+  /// Distance to the reference, in units of the last place of the result
+  const auto ulps = [] (float f, double ref) {
+    if (std::isnan(f) && std::isnan(ref))  return 0.;
+    if (std::isinf(float(ref)))  return f == float(ref) ? 0. : INFINITY;
+    int e;
+    std::frexp(float(ref), &e);
+    double ulp = std::ldexp(1., std::max(e, -125) - 24);
+    return std::fabs(f - ref) / ulp;
+  };
+
+  std::cout << std::setprecision(3);
+
+  uint failures = 0;
+  for (const Target &t: targets) {
+    std::vector<float> values;
+    values.reserve(N);
+    for (uint i=0; i<N; i++)
+      values.push_back(t.min + (t.max - t.min) * float(i) / N);
+
+    std::cout << "\n== " << t.name << " over [" << t.min << ", " << t.max
+              << "] (" << N << " values)\n"
+              << std::setw(8) << "" << std::setw(12) << "max ulps"
+              << std::setw(12) << "avg ulps" << std::setw(12) << "= fd"
+              << std::setw(12) << "ns/call" << "\n";
+
+    std::vector<float> outputs (N), fd (N);
+    for (uint i=0; i<N; i++)  fd[i] = t.candidates.front().f(values[i]);
+
+    for (const Candidate &c: t.candidates) {
+      double maxErr = 0, sumErr = 0;
+      uint same = 0;
+      for (uint i=0; i<N; i++) {
+        float v = c.f(values[i]);
+        double err = ulps(v, t.ref(values[i]));
+        maxErr = std::max(maxErr, err);
+        sumErr += err;
+        same += (std::memcmp(&v, &fd[i], sizeof(float)) == 0);
+      }
+
+      using clock = std::chrono::steady_clock;
+      auto start = clock::now();
+      for (uint r=0; r<REPEATS; r++)
+        for (uint i=0; i<N; i++)  outputs[i] = c.f(values[i]);
+      double ns = std::chrono::duration<double, std::nano>(
+                    clock::now() - start).count() / (REPEATS * N);
+
+      std::cout << std::setw(8) << c.name << std::setw(12) << maxErr
+                << std::setw(12) << sumErr / N
+                << std::setw(11) << 100. * same / N << "%"
+                << std::setw(12) << ns << "\n";
+
+      if (maxErr > 4) failures++;
+    }
+  }
+
+  return failures > 0;
+}
@@ -92,6 +92,7 @@ int main (int argc, char **argv) {
   genotype::ES_HyperNEAT genome;
   phenotype::CPPN cppn;
   phenotype::ANN ann;
+  bool empty;
 
   uint mutations = (argc > 2 ? atoi(argv[2]) : 1000);
 
@@ -126,20 +127,16 @@ int main (int argc, char **argv) {
 //    );
 
     // Regular and pretty
-    ann = phenotype::ANN::build(
-      { { -1, -1 }, { 0, -1 }, { 1, -1 } },
-      { { -.5, 1 }, { 0,  1 }, { .5, 1 } },
-      cppn
-    );
+    const phenotype::ANN::Coordinates
+      inputs { { -1, -1 }, { 0, -1 }, { 1, -1 } },
+      outputs { { -.5, 1 }, { 0,  1 }, { .5, 1 } };
 
 #elif ESHN_SUBSTRATE_DIMENSION == 3
-    ann = phenotype::ANN::build(
-      { { -1, -1, -1 }, { -1, -1, 0 }, { -1, -1,  1 },
-        {  0, -1, 0 },
-        {  1, -1, -1 }, {  1, -1, 0 }, {  1, -1,  1 } },
-      { { -.5, 1, 0 }, { 0,  1, 0 }, { .5, 1, 0 }, { 0, 1, -1 } },
-      cppn
-    );
+    const phenotype::ANN::Coordinates
+      inputs { { -1, -1, -1 }, { -1, -1, 0 }, { -1, -1,  1 },
+               {  0, -1, 0 },
+               {  1, -1, -1 }, {  1, -1, 0 }, {  1, -1,  1 } },
+      outputs { { -.5, 1, 0 }, { 0,  1, 0 }, { .5, 1, 0 }, { 0, 1, -1 } };
 
 //    ann = phenotype::ANN::build(
 //      { {  0, -1, -1 }, {  0, -1, +1 } },
@@ -148,17 +145,29 @@ int main (int argc, char **argv) {
 //    );
 #endif
 
-    std::cout << "Seed " << dice.getSeed() << ":" << (ann.empty() ? "" : " not")
+    // No need for the full search if the probe proves it fruitless (unless
+    // out of seeds: something has to be displayed)
+    empty = phenotype::ANN::provablyEmpty(inputs, outputs, cppn);
+    if (empty && seed < baseSeed+100) {
+      std::cout << "Seed " << dice.getSeed() << ": provably empty"
+                << std::endl;
+      continue;
+    }
+
+    ann = phenotype::ANN::build(inputs, outputs, cppn);
+    empty = ann.empty();
+
+    std::cout << "Seed " << dice.getSeed() << ":" << (empty ? "" : " not")
               << " empty" << std::endl;
 
-    if (!ann.empty()) {
+    if (!empty) {
       std::cout << "\t" << ann.neurons().size() << " neurons\n";
       uint e = 0;
       for (const auto &n: ann.neurons()) e += n->links().size();
       std::cout << "\t" << e << " connections\n";
     }
 
-  } while (ann.empty() && seed < baseSeed+100);
+  } while (empty && seed < baseSeed+100);
 
   kgd::es_hyperneat::gui::ES_HyperNEATPanel p;
   p.setData(genome, cppn, ann);  
@@ -0,0 +1,110 @@
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+
+#include "../phenotype/ann.h"
+
+/// Reports how often ANNs built with reduced-precision coarse divisions (see
+/// config::EvolvableSubstrate::reducedPrecisionDepth) or derivative-based band
+/// estimations (derivativeBand) differ from those built without, over random
+/// (and mutated) genomes
+int main (int argc, char *argv[]) {
+  using Genotype = genotype::ES_HyperNEAT;
+  using Config = config::EvolvableSubstrate;
+  using phenotype::ANN;
+  using phenotype::CPPN;
+
+  const uint genomes = argc > 1 ? std::stoi(argv[1]) : 1000;
+
+  ANN::Coordinates inputs, outputs;
+  for (float x: {-1.f, 0.f, 1.f}) {
+#if ESHN_SUBSTRATE_DIMENSION == 2
+    inputs.push_back({x, -1});
+    outputs.push_back({x/2, 1});
+#elif ESHN_SUBSTRATE_DIMENSION == 3
+    inputs.push_back({x, -1, x});
+    outputs.push_back({x/2, 1, 0});
+#endif
+  }
+
+  /// Same neurons, same links (sources) in the same order
+  const auto sameTopology = [] (const ANN &lhs, const ANN &rhs) {
+    if (lhs.neurons().size() != rhs.neurons().size()) return false;
+    for (auto itL = lhs.neurons().begin(), itR = rhs.neurons().begin();
+         itL != lhs.neurons().end(); ++itL, ++itR) {
+      const auto &nL = **itL, &nR = **itR;
+      if (nL.pos != nR.pos || nL.links().size() != nR.links().size())
+        return false;
+      for (uint i=0; i<nL.links().size(); i++)
+        if (nL.links()[i].in.lock()->pos != nR.links()[i].in.lock()->pos)
+          return false;
+    }
+    return true;
+  };
+
+  const auto sameWeights = [] (const ANN &lhs, const ANN &rhs) {
+    for (auto itL = lhs.neurons().begin(), itR = rhs.neurons().begin();
+         itL != lhs.neurons().end(); ++itL, ++itR)
+      for (uint i=0; i<(*itL)->links().size(); i++)
+        if ((*itL)->links()[i].weight != (*itR)->links()[i].weight)
+          return false;
+    return true;
+  };
+
+  using clock = std::chrono::steady_clock;
+  const auto seconds = [] (clock::time_point start) {
+    return std::chrono::duration<double>(clock::now() - start).count();
+  };
+
+  /// Builds every genome with and without the approximation (toggled by
+  /// approx) and prints the share of differing ANNs
+  const auto compare = [&] (const std::string &label,
+                            const std::function<void(bool)> &approx) {
+    rng::FastDice dice (0);
+    uint topology = 0, weights = 0, nonEmpty = 0;
+    double exact = 0, approximate = 0;
+
+    for (uint g=0; g<genomes; g++) {
+      auto genotype = Genotype::random(dice);
+      for (uint i=0; i<g%100; i++)  genotype.mutate(dice);
+      auto cppn = CPPN::fromGenotype(genotype);
+
+      approx(false);
+      auto start = clock::now();
+      ANN lhs = ANN::build(inputs, outputs, cppn);
+      exact += seconds(start);
+
+      approx(true);
+      start = clock::now();
+      ANN rhs = ANN::build(inputs, outputs, cppn);
+      approximate += seconds(start);
+
+      nonEmpty += !lhs.empty();
+      if (!sameTopology(lhs, rhs))      topology++;
+      else if (!sameWeights(lhs, rhs))  weights++;
+    }
+    approx(false);
+
+    std::cout << std::setw(9) << label
+              << std::setw(11) << 100. * topology / genomes << "%"
+              << std::setw(11) << 100. * weights / genomes << "%"
+              << std::setw(11) << 100. * nonEmpty / genomes << "%"
+              << std::setw(11) << exact / approximate << "x" << std::endl;
+  };
+
+  std::cout << std::setw(9) << "approx." << std::setw(12) << "topology"
+            << std::setw(12) << "weights" << std::setw(12) << "non-empty"
+            << std::setw(12) << "speedup" << "\n";
+
+  // Connection weights are always computed at full precision
+  for (uint depth = 2; depth <= Config::maxDepth()+1; depth++)
+    compare("depth " + std::to_string(depth), [depth] (bool on) {
+      Config::reducedPrecisionDepth() = on ? depth : 0;
+    });
+
+  // Weights are exact but bands are only estimated
+  compare("deriv.", [] (bool on) {  Config::derivativeBand() = on;  });
+
+  return 0;
+}
@@ -0,0 +1,64 @@
+#include <iomanip>
+#include <iostream>
+
+#include "../phenotype/ann.h"
+
+/// Checks that ANN::provablyEmpty never claims emptiness for a genome whose
+/// ANN has connections, over random (and mutated) genomes, probing and
+/// division depths (including those whose cell centers are rounded)
+int main (int argc, char *argv[]) {
+  using Genotype = genotype::ES_HyperNEAT;
+  using Config = config::EvolvableSubstrate;
+  using phenotype::ANN;
+  using phenotype::CPPN;
+
+  const uint genomes = argc > 1 ? std::stoi(argv[1]) : 200;
+
+  ANN::Coordinates inputs, outputs;
+  for (float x: {-1.f, 0.f, 1.f}) {
+#if ESHN_SUBSTRATE_DIMENSION == 2
+    inputs.push_back({x, -1});
+    outputs.push_back({x/2, 1});
+#elif ESHN_SUBSTRATE_DIMENSION == 3
+    inputs.push_back({x, -1, x});
+    outputs.push_back({x/2, 1, 0});
+#endif
+  }
+
+  std::cout << std::setw(10) << "max depth" << std::setw(8) << "probe"
+            << std::setw(10) << "claimed" << std::setw(10) << "wrong"
+            << "\n";
+
+  const uint maxDepth = Config::maxDepth(), probeDepth = Config::probeDepth();
+  uint failures = 0;
+  for (uint depth: {maxDepth, maxDepth+1}) {
+    Config::maxDepth() = depth;
+    for (uint probe: {probeDepth, probeDepth+1}) {
+      Config::probeDepth() = probe;
+
+      rng::FastDice dice (0);
+      uint claimed = 0, wrong = 0;
+      for (uint g=0; g<genomes; g++) {
+        auto genotype = Genotype::random(dice);
+        for (uint i=0; i<g%100; i++)  genotype.mutate(dice);
+        auto cppn = CPPN::fromGenotype(genotype);
+
+        if (!ANN::provablyEmpty(inputs, outputs, cppn)) continue;
+        claimed++;
+        if (!ANN::build(inputs, outputs, cppn).empty()) {
+          if (wrong++ < 5)
+            std::cerr << "\tgenome " << g << " is not empty" << std::endl;
+        }
+      }
+
+      std::cout << std::setw(10) << depth << std::setw(8) << probe
+                << std::setw(10) << claimed << std::setw(10) << wrong
+                << std::endl;
+      failures += wrong;
+    }
+  }
+  Config::maxDepth() = maxDepth;
+  Config::probeDepth() = probeDepth;
+
+  return failures > 0;
+}
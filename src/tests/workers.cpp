@@ -0,0 +1,68 @@
+#include <iostream>
+
+#include "../phenotype/ann.h"
+
+/// Checks that ANNs do not depend on the number of workers, over random (and
+/// mutated) genomes and substrates with fewer inputs than workers (whose
+/// quadtrees are then explored by several workers at once)
+int main (int argc, char *argv[]) {
+  using Genotype = genotype::ES_HyperNEAT;
+  using Config = config::EvolvableSubstrate;
+  using phenotype::ANN;
+  using phenotype::CPPN;
+
+  const uint genomes = argc > 1 ? std::stoi(argv[1]) : 100;
+
+  std::vector<std::pair<ANN::Coordinates, ANN::Coordinates>> substrates;
+  for (uint n: {1, 2, 3}) {
+    ANN::Coordinates inputs, outputs;
+    for (uint i=0; i<n; i++) {
+      float x = n > 1 ? -1 + 2.f * i / (n-1) : 0;
+#if ESHN_SUBSTRATE_DIMENSION == 2
+      inputs.push_back({x, -1});
+      outputs.push_back({x/2, 1});
+#elif ESHN_SUBSTRATE_DIMENSION == 3
+      inputs.push_back({x, -1, x});
+      outputs.push_back({x/2, 1, 0});
+#endif
+    }
+    substrates.emplace_back(inputs, outputs);
+  }
+
+  const uint workers = Config::workers();
+  uint failures = 0;
+  for (const auto &[inputs, outputs]: substrates) {
+    rng::FastDice dice (0);
+    uint mismatches = 0, empty = 0;
+    for (uint g=0; g<genomes; g++) {
+      auto genotype = Genotype::random(dice);
+      for (uint i=0; i<g%100; i++)  genotype.mutate(dice);
+      auto cppn = CPPN::fromGenotype(genotype);
+
+      phenotype::ESBuilder builder;
+      Config::workers() = 1;
+      const ANN reference = ANN::build(inputs, outputs, cppn, builder);
+      empty += reference.empty();
+      for (uint w: {2, 4}) {
+        Config::workers() = w;
+        try {
+          assertEqual(ANN::build(inputs, outputs, cppn, builder), reference,
+                      true);
+        } catch (const std::exception &e) {
+          if (mismatches < 5)
+            std::cerr << "\tgenome " << g << " (" << w << " workers): "
+                      << e.what() << std::endl;
+          mismatches++;
+        }
+      }
+    }
+
+    std::cout << inputs.size() << " input(s), " << genomes << " genomes ("
+              << empty << " empty): " << (mismatches ? "FAILED" : "ok")
+              << std::endl;
+    failures += mismatches;
+  }
+  Config::workers() = workers;
+
+  return failures > 0;
+}